@@ -0,0 +1,337 @@
+// Microbenchmarks of scheme construction and parsing.
+// Usage: optspp_bench [--json] [--filter substring] [--min-time seconds]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <optspp/optspp>
+
+using namespace optspp;
+
+namespace {
+  struct options {
+    bool json{false};
+    std::string filter;
+    double min_time{0.2};
+  };
+
+  struct measurement {
+    std::string name;
+    // Work items per iteration, e.g. options or arguments
+    size_t items;
+    size_t iterations;
+    double median_ns;
+    double min_ns;
+  };
+
+  // Results are folded into the sink so that the work is not optimised away
+  volatile size_t sink = 0;
+
+  struct harness {
+    options opts;
+    std::vector<measurement> results;
+
+    void run(const std::string& name, const size_t items, const std::function<size_t()>& f) {
+      if (name.find(opts.filter) == std::string::npos) return;
+      sink = sink + f();
+      std::vector<double> samples;
+      double total = 0;
+      while (((total < opts.min_time * 1e9) || (samples.size() < 3)) && (samples.size() < 100000)) {
+        const auto start = std::chrono::steady_clock::now();
+        sink = sink + f();
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        samples.push_back(ns);
+        total += ns;
+      }
+      std::sort(samples.begin(), samples.end());
+      results.push_back({name, items, samples.size(), samples[samples.size() / 2], samples[0]});
+      if (!opts.json) {
+        const auto& m = results.back();
+        std::printf("%-44s %10zu items %14.0f ns %12.1f ns/item %8zu iters\n",
+                    m.name.c_str(), m.items, m.median_ns, m.median_ns / m.items, m.iterations);
+        std::fflush(stdout);
+      }
+    }
+
+    void print_json() const {
+      std::printf("{\n  \"benchmarks\": [");
+      for (size_t i = 0; i < results.size(); ++i) {
+        const auto& m = results[i];
+        std::printf("%s\n    {\"name\": \"%s\", \"items\": %zu, \"iterations\": %zu, "
+                    "\"median_ns\": %.0f, \"min_ns\": %.0f, \"ns_per_item\": %.2f}",
+                    i > 0 ? "," : "", m.name.c_str(), m.items, m.iterations, m.median_ns, m.min_ns,
+                    m.median_ns / m.items);
+      }
+      std::printf("\n  ]\n}\n");
+    }
+  };
+
+  // Scheme of n named options: --optK with a short name for the first ones, taking any value
+  void flat_scheme(scheme::definition& d, const size_t n) {
+    static const std::string shorts = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    for (size_t i = 0; i < n; ++i) {
+      if (i < shorts.size()) {
+        d | (named(name("opt" + std::to_string(i)), name(shorts[i]), implicit_values("1")) << value(any()));
+      } else {
+        d | (named(name("opt" + std::to_string(i)), implicit_values("1")) << value(any()));
+      }
+    }
+    d | (positional(name("file")) << value(any()));
+  }
+
+  // Flags -a to -p, each taking an implicit value up to occurrences times
+  void cluster_scheme(scheme::definition& d, const size_t occurrences) {
+    for (char c = 'a'; c <= 'p'; ++c) {
+      implicit_values iv("1");
+      (*iv.values).assign(occurrences, "1");
+      d | (named(name(std::string("flag-") + c), name(c), iv) << value(any()));
+    }
+  }
+
+  // Chain of depth levels: --levelK takes x or y (xor), x opens --level(K+1)
+  scheme::entity_ptr xor_chain(const size_t level, const size_t depth) {
+    auto arg = named(name("level" + std::to_string(level)));
+    auto x = value("x");
+    if (level + 1 < depth) x << xor_chain(level + 1, depth);
+    return std::move(arg) << std::move(x) << value("y");
+  }
+
+  // Argument corpora
+  std::vector<std::string> clusters_argv(const size_t n) {
+    static const char* clusters[] = {"-abc", "-de", "-fghij", "-k", "-lmnop"};
+    std::vector<std::string> rslt;
+    for (size_t i = 0; i < n; ++i) rslt.push_back(clusters[i % 5]);
+    return rslt;
+  }
+
+  std::vector<std::string> separators_argv(const size_t n, const size_t options_count) {
+    std::vector<std::string> rslt;
+    for (size_t i = 0; i < n; ++i) rslt.push_back("--opt" + std::to_string(i % options_count) + "=v" + std::to_string(i));
+    return rslt;
+  }
+
+  std::vector<std::string> positionals_argv(const size_t n) {
+    std::vector<std::string> rslt{"-a", "--opt1=x"};
+    for (size_t i = rslt.size(); i < n; ++i) rslt.push_back("file" + std::to_string(i));
+    rslt.resize(n);
+    return rslt;
+  }
+
+  std::vector<std::string> xor_argv(const size_t n, const size_t depth) {
+    std::vector<std::string> rslt;
+    for (size_t i = 0; (i < depth) && (rslt.size() + 2 <= n); ++i) {
+      rslt.push_back("--level" + std::to_string(i));
+      rslt.push_back("x");
+    }
+    for (size_t i = rslt.size(); i < n; ++i) rslt.push_back("file" + std::to_string(i));
+    return rslt;
+  }
+
+  // Realistic schemes
+  void rm_scheme(scheme::definition& d) {
+    d
+      | (named(name("force"), name('f'), implicit_values("true")) << value("true") << value("false"))
+      | (named(name("interactive"), name('i'), implicit_values("always"))
+         << value("never", {"no", "none"}) << value("once") << value("always", {"yes"}))
+      | (named(name("recursive"), name('r', {'R'}), implicit_values("true")) << value("true") << value("false"))
+      | (named(name("dir"), name('d'), implicit_values("true")) << value("true") << value("false"))
+      | (named(name("verbose"), name('v'), implicit_values("true")) << value("true") << value("false"))
+      | (named(name("one-file-system"), implicit_values("true")) << value("true") << value("false"))
+      | (named(name("no-preserve-root"), implicit_values("true")) << value("true") << value("false"))
+      | (positional(name("file"), min_count(1)) << value(any()));
+  }
+
+  void rsync_scheme(scheme::definition& d) {
+    const char* flags[][2] = {{"archive", "a"}, {"verbose", "v"}, {"compress", "z"}, {"recursive", "r"},
+                              {"links", "l"}, {"perms", "p"}, {"times", "t"}, {"group", "g"}, {"owner", "o"},
+                              {"devices", "D"}, {"human-readable", "h"}, {"dry-run", "n"}, {"quiet", "q"},
+                              {"checksum", "c"}, {"update", "u"}, {"hard-links", "H"}};
+    for (const auto& f : flags) d | (named(name(f[0]), name(f[1][0]), implicit_values("1")) << value(any()));
+    const char* long_flags[] = {"delete", "delete-after", "progress", "partial", "stats", "numeric-ids",
+                                "inplace", "append", "sparse", "itemize-changes"};
+    for (const auto& f : long_flags) d | (named(name(f), implicit_values("1")) << value(any()));
+    d
+      | (named(name("rsh"), name('e')) << value(any()))
+      | (named(name("exclude")) << value(any()))
+      | (named(name("include")) << value(any()))
+      | (named(name("bwlimit")) << value(any()))
+      | (named(name("partial-dir")) << value(any()))
+      | (positional(name("path"), min_count(2)) << value(any()));
+  }
+
+  void ffmpeg_scheme(scheme::definition& d) {
+    auto codec = named(name("codec"), name('c'));
+    for (size_t i = 0; i < 300; ++i) codec | value("codec" + std::to_string(i), {"c" + std::to_string(i)});
+    codec | value("h264", {"libx264", "avc"}) | value("hevc", {"libx265", "h265"}) | value("copy");
+    auto preset = named(name("preset"));
+    for (const auto& p : {"ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow"}) {
+      preset << value(p);
+    }
+    d
+      | (named(name("overwrite"), name('y'), implicit_values("true")) << value("true") << value("false"))
+      | (named(name("input"), name('i')) << value(any()))
+      | std::move(codec)
+      | std::move(preset)
+      | (named(name("bitrate"), name('b')) << value(any()))
+      | (named(name("rate"), name('r')) << value(any()))
+      | (named(name("size"), name('s')) << value(any()))
+      | (named(name("map")) << value(any()))
+      | (named(name("filter")) << value(any()))
+      | (named(name("threads")) << value(any()))
+      | (positional(name("output"), min_count(1)) << value(any()));
+  }
+
+  void gcc_scheme(scheme::definition& d) {
+    d
+      | (named(name("compile"), name('c'), implicit_values("1")) << value(any()))
+      | (named(name("assemble"), name('S'), implicit_values("1")) << value(any()))
+      | (named(name("preprocess"), name('E'), implicit_values("1")) << value(any()))
+      | (named(name("output"), name('o')) << value(any()))
+      | (named(name("optimize"), name('O'))
+         << value("0") << value("1") << value("2") << value("3") << value("s") << value("fast"))
+      | (named(name("debug"), name('g'), implicit_values("2")) << value("0") << value("1") << value("2") << value("3"))
+      | (named(name("include"), name('I')) << value(any()))
+      | (named(name("define"), name('D')) << value(any()))
+      | (named(name("library-path"), name('L')) << value(any()))
+      | (named(name("library"), name('l')) << value(any()))
+      | (named(name("warning"), name('W')) << value(any()))
+      | (named(name("std")) << value("c++11") << value("c++14") << value("c++17") << value("c++20") << value("gnu++17"))
+      | (named(name("pedantic"), implicit_values("1")) << value(any()))
+      | (positional(name("input"), min_count(1)) << value(any()));
+  }
+
+  size_t parse_all(const scheme::compiled_scheme& cs, const std::vector<std::vector<std::string>>& cmds) {
+    size_t rslt = 0;
+    for (const auto& c : cmds) rslt += cs.parse(c).positionals().size();
+    return rslt;
+  }
+
+  void bench_construction(harness& h) {
+    for (const size_t n : {10, 100, 2000}) {
+      h.run("scheme/build/" + std::to_string(n), n, [n] () {
+          scheme::definition d;
+          flat_scheme(d, n);
+          return d.root()->children().size();
+        });
+      scheme::definition d;
+      flat_scheme(d, n);
+      h.run("scheme/compile/" + std::to_string(n), n, [&d] () {
+          return d.compile()->size();
+        });
+    }
+    h.run("scheme/build/xor_depth_64", 64, [] () {
+        scheme::definition d;
+        d | xor_chain(0, 64);
+        return d.root()->children().size();
+      });
+  }
+
+  void bench_parse(harness& h) {
+    scheme::definition flat;
+    flat_scheme(flat, 100);
+    auto flat_cs = flat.compile();
+    const size_t depth = 64;
+    scheme::definition deep;
+    deep | xor_chain(0, depth) | (positional(name("file")) << value(any()));
+    auto deep_cs = deep.compile();
+
+    for (const size_t n : {10, 100, 1000, 10000, 100000, 1000000}) {
+      const auto suffix = "/" + std::to_string(n);
+      // Each implicit value is taken once, so the scheme grows with the command line
+      if (n <= 100000) {
+        scheme::definition cd;
+        cluster_scheme(cd, n);
+        auto cluster_cs = cd.compile();
+        const auto clusters = clusters_argv(n);
+        h.run("parse/clusters" + suffix, n, [&] () { return cluster_cs->parse(clusters).values(1).size(); });
+      }
+      const auto separators = separators_argv(n, 100);
+      h.run("parse/separators" + suffix, n, [&] () { return flat_cs->parse(separators).values(1).size(); });
+      const auto positionals = positionals_argv(n);
+      h.run("parse/positionals" + suffix, n, [&] () { return flat_cs->parse(positionals).positionals().size(); });
+      const auto deep_args = xor_argv(n, depth);
+      h.run("parse/xor_depth_64" + suffix, n, [&] () { return deep_cs->parse(deep_args).positionals().size(); });
+    }
+  }
+
+  void bench_realistic(harness& h) {
+    struct program {
+      const char* name;
+      std::function<void(scheme::definition&)> build;
+      std::vector<std::vector<std::string>> cmds;
+    };
+    std::vector<program> programs{
+      {"rm", rm_scheme, {
+          {"-rf", "build"},
+          {"-i", "--verbose", "a.txt", "b.txt", "c.txt"},
+          {"--interactive=never", "-rv", "--one-file-system", "/tmp/x", "/tmp/y"}}},
+      {"rsync", rsync_scheme, {
+          {"-avz", "--delete", "--exclude=*.o", "--exclude=.git", "-e", "ssh -p 2222", "src/", "host:dst/"},
+          {"-rlptgoD", "--progress", "--partial", "--bwlimit=1000", "a", "b"},
+          {"-an", "--itemize-changes", "--stats", "--include=*/", "--exclude=*", "/data/", "/backup/"}}},
+      {"ffmpeg", ffmpeg_scheme, {
+          {"-y", "-i", "in.mp4", "--codec", "libx264", "--preset", "slow", "-b", "2M", "out.mp4"},
+          {"-i", "a.mkv", "-c", "copy", "--map=0", "out.mkv"},
+          {"-i", "in.mov", "--codec=c250", "-r", "30", "-s", "1920x1080", "--threads=8", "out.webm"}}},
+      {"gcc", gcc_scheme, {
+          {"-c", "-O2", "-g", "-Wall", "--std=c++17", "-Iinclude", "-DNDEBUG", "-omain.o", "main.cpp"},
+          {"-S", "-Os", "-o", "a.s", "a.c"},
+          {"-Llib", "-lfoo", "-lbar", "-oapp", "a.o", "b.o", "c.o", "d.o"}}},
+    };
+    for (const auto& p : programs) {
+      h.run(std::string("realistic/") + p.name + "/compile", 1, [&p] () {
+          scheme::definition d;
+          p.build(d);
+          return d.compile()->size();
+        });
+      scheme::definition d;
+      p.build(d);
+      auto cs = d.compile();
+      h.run(std::string("realistic/") + p.name + "/parse", p.cmds.size(), [&cs, &p] () {
+          return parse_all(*cs, p.cmds);
+        });
+    }
+  }
+
+  void bench_completion(harness& h) {
+    scheme::definition d;
+    flat_scheme(d, 2000);
+    auto cs = d.compile();
+    const std::vector<std::vector<std::string>> lines{
+      {"--opt12=x", "file", "--opt1"},
+      {"--opt12=x", "file", "--opt199"},
+      {"-a", "-b", "file", "-"}};
+    h.run("complete/flat_2000", lines.size(), [&cs, &lines] () {
+        size_t rslt = 0;
+        for (const auto& l : lines) rslt += cs->complete(l).size();
+        return rslt;
+      });
+  }
+}
+
+int main(int argc, char* argv[]) {
+  harness h;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0) {
+      h.opts.json = true;
+    } else if ((std::strcmp(argv[i], "--filter") == 0) && (i + 1 < argc)) {
+      h.opts.filter = argv[++i];
+    } else if ((std::strcmp(argv[i], "--min-time") == 0) && (i + 1 < argc)) {
+      h.opts.min_time = std::stod(argv[++i]);
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--json] [--filter substring] [--min-time seconds]\n";
+      return 1;
+    }
+  }
+  bench_construction(h);
+  bench_parse(h);
+  bench_realistic(h);
+  bench_completion(h);
+  if (h.opts.json) h.print_json();
+  return 0;
+}
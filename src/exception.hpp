@@ -1,37 +1,93 @@
 #pragma once
 
+#include <cstdlib>
 #include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
 
 #include "predeclare.hpp"
 
-#include "parser.hpp"
+// Errors are thrown if exceptions are enabled, otherwise the program is aborted. Parsing
+// may report errors without exceptions with try_parse.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define OPTSPP_EXCEPTIONS
+#define OPTSPP_THROW(e) throw e
+#else
+#define OPTSPP_THROW(e) std::abort()
+#endif
 
 namespace optspp {
+  // Exceptions keep structured data, the message is formatted once on the first call to what() or
+  // message(), which may be called from several threads at once.
   struct optspp_error : std::exception {
+    optspp_error();
+    // Copies format their own message
+    optspp_error(const optspp_error& other);
+    optspp_error& operator=(const optspp_error& other);
+
     virtual const char* what() const noexcept override;
-    std::string message;
+    // Formatted message
+    const std::string& message() const;
+
+  protected:
+    virtual std::string format() const;
+    static std::string entity_name(const scheme::entity_ptr& e);
+
+  private:
+    struct formatted {
+      std::once_flag once;
+      std::string message;
+    };
+    std::unique_ptr<formatted> formatted_;
+  };
+
+  // Parse errors, each matches the exception thrown by parse
+  enum class error_code {
+    NONE,
+    CONSUME_VALUE_FAILED,
+    NO_IMPLICIT_VALUE,
+    VALUE_CONFLICT,
+    UNPARSED_TOKENS,
+    ACTUAL_COUNTS_MISMATCH,
+    AMBIGUOUS_ABBREVIATION
   };
 
   struct scheme_error : optspp_error {
     scheme_error(const std::string& msg);
+
+  protected:
+    std::string format() const override;
+
+  private:
+    std::string msg_;
   };
 
   struct consume_value_failed : optspp_error {
     consume_value_failed(const scheme::entity_ptr& e);
 
     scheme::entity_ptr entity;
+
+  protected:
+    std::string format() const override;
   };
   
   struct no_implicit_value : optspp_error {
     no_implicit_value(const scheme::entity_ptr& e);
 
     scheme::entity_ptr entity;
+
+  protected:
+    std::string format() const override;
   };
 
   struct argument_conflict : optspp_error {
     argument_conflict(const scheme::entity_ptr& e);
     
     scheme::entity_ptr entity;
+
+  protected:
+    std::string format() const override;
   };
     
   struct value_conflict : optspp_error {
@@ -39,13 +95,22 @@ namespace optspp {
     
     std::string value;
     scheme::entity_ptr entity;
+
+  protected:
+    std::string format() const override;
   };
 
-  struct unparsed_tokens : optspp_error {
-    unparsed_tokens(const std::list<scheme::parser::token>& ts);
-    std::list<scheme::parser::token> tokens;
+  struct ambiguous_abbreviation : optspp_error {
+    ambiguous_abbreviation(const std::string& n, const std::vector<scheme::entity_ptr>& cs);
+
+    std::string name;
+    // Arguments having names that start with the abbreviation
+    std::vector<scheme::entity_ptr> candidates;
+
+  protected:
+    std::string format() const override;
   };
-  
+
   struct actual_counts_mismatch : optspp_error {
     struct record {
       scheme::entity_ptr entity;
@@ -54,6 +119,9 @@ namespace optspp {
     actual_counts_mismatch(const std::vector<record>& rs);
     
     std::vector<record> records;
+
+  protected:
+    std::string format() const override;
   };
 
   struct value_not_found : optspp_error {
@@ -62,5 +130,80 @@ namespace optspp {
 
     size_t index{0};
     std::string name;
+
+  protected:
+    std::string format() const override;
+
+  private:
+    bool has_index_{false};
+  };
+
+  struct response_file_error : optspp_error {
+    response_file_error(const std::string& f, const std::string& _reason);
+
+    std::string file;
+    std::string reason;
+
+  protected:
+    std::string format() const override;
+  };
+
+  struct value_conversion_failed : optspp_error {
+    value_conversion_failed(const std::string& n, const std::string& v,
+                            const size_t _pos_arg_num, const size_t _pos_in_arg);
+
+    std::string name;
+    std::string value;
+    size_t pos_arg_num;
+    size_t pos_in_arg;
+
+  protected:
+    std::string format() const override;
+  };
+}
+
+#include "parser.hpp"
+
+namespace optspp {
+  struct unparsed_tokens : optspp_error {
+    struct record {
+      size_t pos_arg_num;
+      size_t pos_in_arg;
+      std::string s;
+    };
+    unparsed_tokens(const std::vector<scheme::parser::token>& ts);
+    unparsed_tokens(const std::vector<record>& rs);
+    std::vector<record> tokens;
+
+  protected:
+    std::string format() const override;
+  };
+
+  // Parse failure reported without exceptions. Like parse_result, unparsed tokens view the parsed
+  // arguments, which the error keeps unless the parse was zero-copy.
+  struct parse_error {
+    error_code code{error_code::NONE};
+    // Argument that failed, if any
+    scheme::entity_ptr entity;
+    // Position of the token that failed, the first unparsed one for unparsed tokens
+    size_t pos_arg_num{std::numeric_limits<size_t>::max()};
+    size_t pos_in_arg{std::numeric_limits<size_t>::max()};
+    // Conflicting value, or the ambiguous abbreviation
+    std::string value;
+    std::vector<scheme::entity_ptr> candidates;
+    std::vector<actual_counts_mismatch::record> records;
+    // Unparsed tokens as given on command line, built on each call
+    std::vector<unparsed_tokens::record> tokens() const;
+
+    // Throw the exception parse would have thrown
+    [[noreturn]] void raise() const;
+
+    friend struct scheme::parser;
+    friend struct scheme::compiled_scheme;
+
+  private:
+    std::vector<scheme::parser::token> unparsed_;
+    // Parsed arguments kept by the error if the parse was not zero-copy
+    std::shared_ptr<const void> storage_;
   };
 }
@@ -4,88 +4,214 @@
 #include "parser.hpp"
 
 namespace optspp {
+  optspp_error::optspp_error() :
+    formatted_(new formatted) {
+  }
+
+  optspp_error::optspp_error(const optspp_error& other) :
+    std::exception(other),
+    formatted_(new formatted) {
+  }
+
+  optspp_error& optspp_error::operator=(const optspp_error& other) {
+    std::exception::operator=(other);
+    formatted_.reset(new formatted);
+    return *this;
+  }
+
   const char* optspp_error::what() const noexcept {
-    return message.c_str();
+#ifdef OPTSPP_EXCEPTIONS
+    try {
+      return message().c_str();
+    } catch (...) {
+      return "";
+    }
+#else
+    return message().c_str();
+#endif
+  }
+
+  const std::string& optspp_error::message() const {
+    // A format that throws leaves the flag unset, the next call tries again
+    std::call_once(formatted_->once, [this] () { formatted_->message = format(); });
+    return formatted_->message;
+  }
+
+  std::string optspp_error::format() const {
+    return std::string();
+  }
+
+  std::string optspp_error::entity_name(const scheme::entity_ptr& e) {
+    std::string name = e->all_names_to_string();
+    if (name == "") name = "<Unnamed>";
+    return name;
+  }
+
+  scheme_error::scheme_error(const std::string& msg) :
+    msg_(msg) {
   }
 
-  scheme_error::scheme_error(const std::string& msg) {
-    message = msg;
+  std::string scheme_error::format() const {
+    return msg_;
   }
 
   consume_value_failed::consume_value_failed(const scheme::entity_ptr& e) :
     entity(e) {
-    std::string name = entity->all_names_to_string();
-    if (name == "") name = "<Unnamed>";
-    message = "Consume value failed for argument " + name;
   }
-  
+
+  std::string consume_value_failed::format() const {
+    return "Consume value failed for argument " + entity_name(entity);
+  }
+
   no_implicit_value::no_implicit_value(const scheme::entity_ptr& e) :
     entity(e) {
-    std::string name = entity->all_names_to_string();
-    if (name == "") name = "<Unnamed>";
-    message = "Argument " + name + " specified without a value, but no implicit value is defined";
+  }
+
+  std::string no_implicit_value::format() const {
+    return "Argument " + entity_name(entity) + " specified without a value, but no implicit value is defined";
   }
 
   argument_conflict::argument_conflict(const scheme::entity_ptr& e) :
     entity(e) {
-    std::string name = entity->all_names_to_string();
-    if (name == "") name = "<Unnamed>";
-    message = "Argument " + name + " conflicts with other arguments";
   }
-  
+
+  std::string argument_conflict::format() const {
+    return "Argument " + entity_name(entity) + " conflicts with other arguments";
+  }
+
   value_conflict::value_conflict(const scheme::entity_ptr& e, const std::string& v) :
     entity(e),
     value(v) {
-    std::string name = entity->all_names_to_string();
-    if (name == "") name = "<Unnamed>";
-    message = "Argument " + name + " specified with value '" + value + "' conflicts with other argument values";
   }
 
-  unparsed_tokens::unparsed_tokens(const std::list<scheme::parser::token>& ts) :
-    tokens(ts) {
-    message = "Unparsed tokens left: ";
+  std::string value_conflict::format() const {
+    return "Argument " + entity_name(entity) + " specified with value '" + value + "' conflicts with other argument values";
+  }
+
+  unparsed_tokens::unparsed_tokens(const std::vector<scheme::parser::token>& ts) {
+    tokens.reserve(ts.size());
+    for (const auto& t : ts) tokens.push_back({t.pos_arg_num, t.pos_in_arg, t.to_string()});
+  }
+
+  unparsed_tokens::unparsed_tokens(const std::vector<record>& rs) :
+    tokens(rs) {
+  }
+
+  std::string unparsed_tokens::format() const {
+    std::string rslt = "Unparsed tokens left: ";
     bool need_comma = false;
-    for (const auto& t : ts) {
-      if (need_comma) message += " ";
+    for (const auto& t : tokens) {
+      if (need_comma) rslt += " ";
       need_comma = true;
-      message += t.s;
+      rslt += t.s;
     }
+    return rslt;
+  }
+
+  ambiguous_abbreviation::ambiguous_abbreviation(const std::string& n, const std::vector<scheme::entity_ptr>& cs) :
+    name(n),
+    candidates(cs) {
+  }
+
+  std::string ambiguous_abbreviation::format() const {
+    std::string rslt = "Argument name '" + name + "' is ambiguous, candidates: ";
+    bool need_comma = false;
+    for (const auto& c : candidates) {
+      if (need_comma) rslt += ", ";
+      rslt += entity_name(c);
+      need_comma = true;
+    }
+    return rslt;
   }
 
   actual_counts_mismatch::actual_counts_mismatch(const std::vector<record>& rs) :
     records(rs) {
-    message = "Actual argument value counts mismatch. ";
+  }
+
+  std::string actual_counts_mismatch::format() const {
+    std::string rslt = "Actual argument value counts mismatch. ";
     bool need_comma = false;
     for (const auto& r : records) {
-      if (need_comma) message += " ";
+      if (need_comma) rslt += " ";
       need_comma = true;
-      std::string name = r.entity->all_names_to_string();
-      if (name == "") name = "<Unnamed>";
-      message += "Argument " + name + " ";
+      rslt += "Argument " + entity_name(r.entity) + " ";
       bool need_inner_comma = false;
       if (r.entity->min_count()) {
-        message += "minimum expected " + std::to_string(*r.entity->min_count());
+        rslt += "minimum expected " + std::to_string(*r.entity->min_count());
         need_inner_comma = true;
       }
       if (r.entity->max_count()) {
-        if (need_inner_comma) message += ", ";
-        message += "maximum expected " + std::to_string(*r.entity->max_count());
+        if (need_inner_comma) rslt += ", ";
+        rslt += "maximum expected " + std::to_string(*r.entity->max_count());
         need_inner_comma = true;
       }
-      if (need_inner_comma) message += ", ";
-      message += "actual " + std::to_string(r.actual);
-      message += ".";
+      if (need_inner_comma) rslt += ", ";
+      rslt += "actual " + std::to_string(r.actual);
+      rslt += ".";
     }
+    return rslt;
   }
 
   value_not_found::value_not_found(const std::string& n) :
     name(n) {
-    message = "Argument '" + name + "' has no values";
   }
 
   value_not_found::value_not_found(const std::string& n, const size_t idx) :
+    index(idx),
+    name(n),
+    has_index_(true) {
+  }
+
+  std::string value_not_found::format() const {
+    if (has_index_) return "Index " + std::to_string(index) + " for argument '" + name + "' is out bounds";
+    return "Argument '" + name + "' has no values";
+  }
+
+  response_file_error::response_file_error(const std::string& f, const std::string& _reason) :
+    file(f),
+    reason(_reason) {
+  }
+
+  std::string response_file_error::format() const {
+    return "Response file '" + file + "' " + reason;
+  }
+
+  value_conversion_failed::value_conversion_failed(const std::string& n, const std::string& v,
+                                                   const size_t _pos_arg_num, const size_t _pos_in_arg) :
     name(n),
-    index(idx) {
-    message = "Index " + std::to_string(idx) + " for argument '" + name + "' is out bounds";
+    value(v),
+    pos_arg_num(_pos_arg_num),
+    pos_in_arg(_pos_in_arg) {
+  }
+
+  std::string value_conversion_failed::format() const {
+    return "Value '" + value + "' of argument '" + name + "' at argument " + std::to_string(pos_arg_num) +
+      ", position " + std::to_string(pos_in_arg) + " can not be converted";
+  }
+
+  std::vector<unparsed_tokens::record> parse_error::tokens() const {
+    std::vector<unparsed_tokens::record> rslt;
+    rslt.reserve(unparsed_.size());
+    for (const auto& t : unparsed_) rslt.push_back({t.pos_arg_num, t.pos_in_arg, t.to_string()});
+    return rslt;
+  }
+
+  void parse_error::raise() const {
+    switch (code) {
+    case error_code::CONSUME_VALUE_FAILED:
+      OPTSPP_THROW(consume_value_failed(entity));
+    case error_code::NO_IMPLICIT_VALUE:
+      OPTSPP_THROW(no_implicit_value(entity));
+    case error_code::VALUE_CONFLICT:
+      OPTSPP_THROW(value_conflict(entity, value));
+    case error_code::UNPARSED_TOKENS:
+      OPTSPP_THROW(unparsed_tokens(unparsed_));
+    case error_code::ACTUAL_COUNTS_MISMATCH:
+      OPTSPP_THROW(actual_counts_mismatch(records));
+    case error_code::AMBIGUOUS_ABBREVIATION:
+      OPTSPP_THROW(ambiguous_abbreviation(value, candidates));
+    default:
+      OPTSPP_THROW(scheme_error("Parse error raised without an error"));
+    }
   }
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <utility>
+#include <variant>
+
 namespace optspp {
   template <typename T>
   struct optional {
@@ -33,4 +36,57 @@ namespace optspp {
     bool some_;
     T value_;
   };
+
+  // Value or error, for reporting errors without exceptions. Holds one of them only, neither has to be
+  // default constructible.
+  template <typename T, typename E>
+  struct expected {
+    expected(const T& value) :
+      v_(std::in_place_index<0>, value) {
+    }
+
+    expected(T&& value) :
+      v_(std::in_place_index<0>, std::move(value)) {
+    }
+
+    static expected<T, E> failure(const E& error) {
+      return expected<T, E>(std::in_place_index<1>, error);
+    }
+
+    constexpr bool has_value() const noexcept {
+      return v_.index() == 0;
+    }
+
+    constexpr explicit operator bool() const noexcept {
+      return has_value();
+    }
+
+    T& operator*() {
+      return *std::get_if<0>(&v_);
+    }
+
+    const T& operator*() const {
+      return *std::get_if<0>(&v_);
+    }
+
+    T* operator->() {
+      return std::get_if<0>(&v_);
+    }
+
+    const T* operator->() const {
+      return std::get_if<0>(&v_);
+    }
+
+    const E& error() const {
+      return *std::get_if<1>(&v_);
+    }
+
+  private:
+    template <std::size_t I, typename V>
+    expected(std::in_place_index_t<I> i, V&& v) :
+      v_(i, std::forward<V>(v)) {
+    }
+
+    std::variant<T, E> v_;
+  };
 }
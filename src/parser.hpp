@@ -1,89 +1,273 @@
 #pragma once
 
-#include <list>
+#include <cstdint>
+#include <vector>
+
+// Define OPTSPP_PARSE_STATS before including optspp to collect parse_context::parse_stats,
+// otherwise the statistics code compiles to nothing
+#ifdef OPTSPP_PARSE_STATS
+#include <chrono>
+#define OPTSPP_STATS(...) __VA_ARGS__
+#else
+#define OPTSPP_STATS(...)
+#endif
 
 namespace optspp {
   namespace scheme {
-    struct parser {
-      struct token {
-        token();
-    
-        token(const size_t& _pos_arg_num,
-              const size_t& _pos_in_arg,
-              const std::string& _s);
-        token(const token& other);
-        void swap(token& other);
-
-        // True if contains data
-        explicit operator bool() const noexcept;
-                   
-        size_t pos_arg_num;
-        size_t pos_in_arg;
-        std::string s;
-    
+    // Command line token, classified once by the tokenizer. Spans view the parsed arguments.
+    struct token {
+      enum class KIND {
+        // Long-prefixed option, e.g. --name or --name=value
+        LONG,
+        // Short-prefixed option, clusters like -rf are split into one token per option
+        SHORT,
+        // Argument without prefix, or any argument after a terminator like --
+        POSITIONAL
+      };
+
+      // Token text as it was given on command line
+      std::string to_string() const;
+
+      KIND kind{KIND::POSITIONAL};
+      size_t pos_arg_num{std::numeric_limits<size_t>::max()};
+      size_t pos_in_arg{std::numeric_limits<size_t>::max()};
+      std::string_view prefix;
+      std::string_view name;
+      std::string_view separator;
+      // Value attached to option with separator, or the whole positional argument
+      std::string_view value;
+      bool has_value{false};
+      // Resolved argument name, compiled_scheme::npos if not a known option name
+      size_t name_id{compiled_scheme::npos};
+    };
+
+    // Per-parse mutable state. A context may be reused by consecutive parses to keep its buffers,
+    // but must not be shared by concurrent parses: keep one per thread.
+    struct parse_context {
+      enum class COLOR {
+        NONE,
+        BORDER,
+        VISITED,
+        BLOCKED
+      };
+
+      // Deterministic work done by the last parse, for complexity checks
+      struct work_counters {
+        // Calls of parser::pass_tree
+        size_t passes{0};
+        // Border nodes taken off the worklist by find_border_entity, stale entries included, and
+        // positional children examined while looking for positional arguments
+        size_t nodes_visited{0};
+        // Tokens examined while looking for named and positional argument tokens
+        size_t tokens_scanned{0};
+      };
+
+#ifdef OPTSPP_PARSE_STATS
+      // Statistics of the last parse
+      struct parse_stats {
+        size_t passes{0};
+        size_t entities_visited{0};
+        size_t tokens_examined{0};
+        // Growths of the token, context and result buffers filled by the parse. Not a count of all
+        // heap allocations: value strings, conversions and error reports are not counted
+        size_t buffer_growths{0};
+        // Time spent tokenizing arguments, in parse passes and in validate_results
+        std::chrono::nanoseconds preprocess_time{0};
+        std::chrono::nanoseconds passes_time{0};
+        std::chrono::nanoseconds validate_time{0};
+      };
+
+      // Adds time elapsed until destruction to the duration
+      struct stats_timer {
+        stats_timer(std::chrono::nanoseconds& total);
+        ~stats_timer();
+
       private:
-        bool some_{false};
+        std::chrono::nanoseconds& total_;
+        std::chrono::steady_clock::time_point start_;
       };
+#endif
+
+      // Prepare state for parsing a scheme with nodes_count nodes
+      void reset(const size_t nodes_count);
+      COLOR color(const size_t idx) const;
+      const work_counters& counters() const;
+#ifdef OPTSPP_PARSE_STATS
+      parse_stats stats() const;
+#endif
+
+      friend struct parser;
+
+    private:
+      // Node state bits, indexed by compiled scheme node
+      static bool test(const std::vector<uint64_t>& bits, const size_t idx);
+      static void set(std::vector<uint64_t>& bits, const size_t idx);
+      static void clear(std::vector<uint64_t>& bits, const size_t idx);
+      bool blocked(const size_t idx) const;
+      // Buffer operations of the parse, counting reallocations in parse statistics
+      template <typename Buffer, typename Value>
+      void append(Buffer& b, Value&& v);
+      template <typename Buffer, typename Value>
+      void fill(Buffer& b, const size_t count, const Value& v);
+      template <typename Buffer>
+      void reserve(Buffer& b, const size_t count);
+
+      // Node state bitsets, indexed by compiled scheme node. A node is BLOCKED if its blocked bit is set,
+      // VISITED if its border and visited bits are, and BORDER if only its border bit is.
+      std::vector<uint64_t> border_;
+      std::vector<uint64_t> visited_bits_;
+      std::vector<uint64_t> blocked_;
+      // Number of implicit values already taken by argument
+      std::vector<size_t> implicit_taken_;
+      // Number of default values already taken by argument
+      std::vector<size_t> default_taken_;
+      // Positional argument node and argument number it was taken from
+      std::vector<std::pair<size_t, size_t>> positionals_;
+      // Border nodes with argument children still to be taken in this pass, min-heap by node index
+      std::vector<size_t> frontier_;
+      // Nodes taken in this pass, reopened by the next one
+      std::vector<size_t> visited_;
+      // Indices of tokens naming a named argument child, by parent node, in token order
+      std::vector<std::vector<size_t>> named_tokens_;
+      // First entry of named_tokens_ that may still be taken, by parent node
+      std::vector<size_t> named_cursor_;
+      // First entry of the positional tokens that may still be taken, by positional argument node
+      std::vector<size_t> arg_cursor_;
+      // Tokens of the parse and their state, see parser
+      std::vector<token> tokens_;
+      std::vector<bool> consumed_;
+      std::vector<size_t> next_;
+      std::vector<size_t> positional_tokens_;
+      work_counters counters_;
+#ifdef OPTSPP_PARSE_STATS
+      // Allocations and times, counters_ are merged in by stats()
+      parse_stats stats_;
+#endif
+    };
+
+    struct parser {
+      // Command line token, see scheme::token
+      using token = scheme::token;
       
-      parser(definition& scheme_def, const std::vector<std::string>& cmdl_args);
+      // Tokens view the arguments, which must outlive the parser and the result
+      parser(const compiled_scheme& scheme,
+             parse_context& context,
+             parse_result& result,
+             const std::vector<std::string>& cmdl_args);
+      parser(const compiled_scheme& scheme,
+             parse_context& context,
+             parse_result& result,
+             const size_t args_count,
+             const char* const args[]);
+      parser(const compiled_scheme& scheme,
+             parse_context& context,
+             parse_result& result,
+             const size_t args_count,
+             const std::string_view args[]);
 
+      // Parse, throws the exception matching error() on failure
       void parse();
+      // Check argument value counts, throws actual_counts_mismatch
+      void validate_results();
+      // Same as parse and validate_results, but return false with error() set instead of throwing
+      bool try_parse();
+      bool try_validate_results();
+      // Failure of the parse so far
+      parse_error error() const;
+      bool failed() const;
 
+      // Color of scheme node in this parse
+      parse_context::COLOR color(const size_t idx) const;
+      parse_context::COLOR color(const entity_ptr& e) const;
+      parse_context::COLOR color(const entity* e) const;
       
-      // Clear color for a tree branch
-      void clear_color(entity_ptr& e);
+      // Reopen nodes taken by the previous pass
       void initialize_pass();
-      entity_ptr find_border_entity() const;
+      // Takes the lowest-index open border node, returns compiled_scheme::npos if there is none
+      size_t find_border_entity();
       // Find next node in tree to try parsing the argument
       bool pass_tree();
-      // Add node to tree border, color taken entity_ptr as VISITED, and XOR-grouped siblings as BLOCKED
-      void move_border(entity_ptr& parent, entity_ptr& entity);
+      // Add node to tree border, color taken entity as VISITED, and XOR-grouped siblings as BLOCKED
+      void move_border(const size_t parent, const size_t child);
+      // Queue border node for the pass if it may take arguments
+      void open(const size_t idx);
 
       // Consume different types of tokens
-      // Extracts named argument's value taking into considiration implicit values
-      void consume_named_value(entity_ptr& arg_def, const std::list<token>::iterator& value_token);
-      // Finds token that matches named arg definition
-      std::list<parser::token>::iterator find_token_for_named(const entity_ptr& arg_def);
-      // Extracts positional argument's value, only for predefined positional values
-      bool consume_positional(entity_ptr& arg_def,
-                              const std::list<token>::iterator& token,
+      // Extracts named argument's value taking into considiration implicit values, false on failure
+      bool consume_named_value(const size_t arg_def, const size_t value_token);
+      // Finds first token that names a non-blocked named argument child of parent, sets arg_def to the argument.
+      // Returns token index, npos if none
+      size_t find_token_for_named(const size_t parent, size_t& arg_def);
+      // Extracts positional argument's value, only for predefined positional values. Returns false if nothing
+      // was consumed, failed() tells if that was an error
+      bool consume_positional(const size_t arg_def,
+                              const size_t token,
                               const bool only_known_value);
-      bool consume_argument_positional_any(entity_ptr& parent);
-      // Find token that looks like a positional arg
-      std::list<parser::token>::iterator find_token_for_positional(const entity_ptr& arg_def);
-      // Tries to parse current position as a prefixed named argument, then as positional with known value
-      bool consume_argument(entity_ptr& parent);
+      bool consume_argument_positional_any(const size_t parent);
+      // True if the positional token follows an unconsumed option without attached value, that may take it
+      bool may_be_option_value(const size_t token) const;
+      // Tries to parse current position as a prefixed named argument, then as positional with known value.
+      // Returns false if nothing was consumed, failed() tells if that was an error
+      bool consume_argument(const size_t parent);
     
     private:
-      definition& scheme_def_;
-      std::list<token> tokens_;
-      bool ignore_option_prefixes_{false};
-      std::vector<std::pair<scheme::entity_ptr, token>> positionals_tmp_;
-
+      const compiled_scheme& scheme_;
+      parse_context& context_;
+      parse_result& result_;
+      // Token buffers, kept by the context for later parses
+      std::vector<token>& tokens_;
+      // Consumed tokens bitmap
+      std::vector<bool>& consumed_;
+      // For a consumed token, a later token to continue the search for an unconsumed one from
+      std::vector<size_t>& next_;
+      size_t tokens_left_{0};
+      // Indices of positional tokens, in token order
+      std::vector<size_t>& positional_tokens_;
+      // First entry of positional_tokens_ that may be unconsumed
+      size_t positional_cursor_{0};
+      // First failure, the argument node and token it happened at
+      error_code error_{error_code::NONE};
+      size_t error_node_{compiled_scheme::npos};
+      size_t error_token_{compiled_scheme::npos};
+      std::vector<actual_counts_mismatch::record> mismatches_;
+      // Argument nodes an ambiguous abbreviation may stand for
+      std::vector<size_t> candidates_;
 
-      // Split name/values with custom separators
-      void preprocess();
+      // Record failure, returns false
+      bool fail(const error_code code, const size_t node, const size_t token);
 
-      // Prefix-related utils
-      // True if s is prefixed with one of the strings in prefixes
-      static bool is_prefixed(const std::string& s, const std::vector<std::string>& prefixes);
-      // True if s is prefixed with one of the strings in long prefixes
-      bool is_long_prefixed(const std::string& s) const;
-      // True if s is prefixed with one of the strings in short prefixes
-      bool is_short_prefixed(const std::string& s) const;
-      // Return position, prefix, unprefixed
-      std::tuple<size_t, std::string, std::string> unprefix(const std::string& s);
+      // Classify command line arguments, split option names and values, expand short option clusters
+      // and resolve option names to scheme name ids
+      template <typename Args>
+      void tokenize(const size_t args_count, const Args& args);
+      // Prepare context and result for parsing
+      void initialize();
+      // Add token to storage and to the lookup lists
+      void add_token(const token& t);
+      // Mark token as consumed
+      void consume(const size_t token);
+      // First unconsumed token at or after idx, tokens_.size() if none
+      size_t next_unconsumed(const size_t idx);
+      // Tokens left unconsumed
+      std::vector<token> unconsumed() const;
+      // Returns the prefix s starts with, empty if none
+      static std::string_view match_prefix(const std::string_view& s, const std::vector<std::string>& prefixes);
 
+      // Value child of argument that matches s, compiled_scheme::npos if none
+      size_t find_value(const size_t arg_def, const std::string_view& s, const bool only_known_value) const;
       // Translates value to a main value, if available
-      const std::string& main_value(const entity_ptr& arg_def, const std::string& s);
-      // Adds named value to results
-      void add_value(const entity_ptr& arg_def, const std::string& s);
+      std::string_view main_value(const size_t arg_def, const std::string_view& s) const;
+      // Adds named value to results, t is the token the value was taken from
+      void add_value(const size_t arg_def, const std::string_view& s, const token& t);
       // Ads positional argument value to results
-      void add_positional_value(const entity_ptr& arg_def, const token& t);
-      // Adds implicit value, throws if no implicit values left
-      void add_value_implicit(entity_ptr& arg_def, const token& token);
+      void add_positional_value(const size_t arg_def, const token& t);
+      // True if argument has implicit values left
+      bool has_implicit_value(const size_t arg_def) const;
+      // Adds next implicit value, there should be one left
+      void add_value_implicit(const size_t arg_def, const token& token);
       // Adds default value, throws if no default values left
-      void add_value_default(entity_ptr& arg_def, const token& token);
+      void add_value_default(const size_t arg_def, const token& token);
+      void min_value_check(std::vector<actual_counts_mismatch::record>& acc, const size_t idx) const;
     
     };
   }
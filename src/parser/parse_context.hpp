@@ -0,0 +1,92 @@
+#pragma once
+
+namespace optspp {
+  namespace scheme {
+    void parse_context::reset(const size_t nodes_count) {
+      OPTSPP_STATS(stats_ = parse_stats();)
+      const size_t words_count = (nodes_count + 63) / 64;
+      fill(border_, words_count, uint64_t(0));
+      fill(visited_bits_, words_count, uint64_t(0));
+      fill(blocked_, words_count, uint64_t(0));
+      fill(implicit_taken_, nodes_count, 0);
+      fill(default_taken_, nodes_count, 0);
+      positionals_.clear();
+      frontier_.clear();
+      visited_.clear();
+      // Keep queue buffers of previous parses
+      reserve(named_tokens_, nodes_count);
+      named_tokens_.resize(nodes_count);
+      for (auto& q : named_tokens_) q.clear();
+      fill(named_cursor_, nodes_count, 0);
+      fill(arg_cursor_, nodes_count, 0);
+      tokens_.clear();
+      positional_tokens_.clear();
+      counters_ = work_counters();
+    }
+
+    template <typename Buffer, typename Value>
+    void parse_context::append(Buffer& b, Value&& v) {
+      OPTSPP_STATS(const size_t capacity = b.capacity();)
+      b.push_back(std::forward<Value>(v));
+      OPTSPP_STATS(if (b.capacity() != capacity) ++stats_.buffer_growths;)
+    }
+
+    template <typename Buffer, typename Value>
+    void parse_context::fill(Buffer& b, const size_t count, const Value& v) {
+      OPTSPP_STATS(if (b.capacity() < count) ++stats_.buffer_growths;)
+      b.assign(count, v);
+    }
+
+    template <typename Buffer>
+    void parse_context::reserve(Buffer& b, const size_t count) {
+      OPTSPP_STATS(if (b.capacity() < count) ++stats_.buffer_growths;)
+      b.reserve(count);
+    }
+
+    auto parse_context::color(const size_t idx) const -> COLOR {
+      if (test(blocked_, idx)) return COLOR::BLOCKED;
+      if (test(visited_bits_, idx)) return COLOR::VISITED;
+      if (test(border_, idx)) return COLOR::BORDER;
+      return COLOR::NONE;
+    }
+
+    bool parse_context::test(const std::vector<uint64_t>& bits, const size_t idx) {
+      return (bits[idx / 64] >> (idx % 64)) & 1;
+    }
+
+    void parse_context::set(std::vector<uint64_t>& bits, const size_t idx) {
+      bits[idx / 64] |= uint64_t(1) << (idx % 64);
+    }
+
+    void parse_context::clear(std::vector<uint64_t>& bits, const size_t idx) {
+      bits[idx / 64] &= ~(uint64_t(1) << (idx % 64));
+    }
+
+    bool parse_context::blocked(const size_t idx) const {
+      return test(blocked_, idx);
+    }
+
+    auto parse_context::counters() const -> const work_counters& {
+      return counters_;
+    }
+
+#ifdef OPTSPP_PARSE_STATS
+    auto parse_context::stats() const -> parse_stats {
+      parse_stats rslt(stats_);
+      rslt.passes = counters_.passes;
+      rslt.entities_visited = counters_.nodes_visited;
+      rslt.tokens_examined = counters_.tokens_scanned;
+      return rslt;
+    }
+
+    parse_context::stats_timer::stats_timer(std::chrono::nanoseconds& total) :
+      total_(total),
+      start_(std::chrono::steady_clock::now()) {
+    }
+
+    parse_context::stats_timer::~stats_timer() {
+      total_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+    }
+#endif
+  }
+}
@@ -1,306 +1,422 @@
 #pragma once
 
-#include <queue>
+#include <functional>
 
 namespace optspp {
   namespace scheme {
-    parser::parser(definition& scheme_def,
+    parser::parser(const compiled_scheme& scheme,
+                   parse_context& context,
+                   parse_result& result,
                    const std::vector<std::string>& cmdl_args) :
-      scheme_def_(scheme_def) {
-      for (size_t i = 0; i < cmdl_args.size(); ++i) tokens_.push_back({i, 0, cmdl_args[i]});
-      preprocess();
-    }
-  
-    void parser::preprocess() {
-      // This is not in parsing routine because it should not be recursive to make sure {xxx=yyy=zzz} stays as {xxx, yyy=zzz}
-      std::list<token> ts;
-      while (tokens_.size() > 0) {
-        const auto& t = *(tokens_.begin());
-        for (const auto& sep : scheme_def_.separators_) {
-          auto pos = t.s.find(sep);
-          if (pos != std::string::npos) {
-            std::string key = t.s.substr(0, pos);
-            size_t value_pos = pos + sep.length() + 1;
-            std::string value = t.s.substr(value_pos, t.s.length() - value_pos);
-            ts.push_back({t.pos_arg_num, t.pos_in_arg, key});
-            ts.push_back({t.pos_arg_num, t.pos_in_arg + value_pos, value});
-          } else {
-            ts.push_back(t);
-          }
-        }
-        tokens_.erase(tokens_.begin());
-      }
-      std::swap(ts, tokens_);
-      // TODO: Add value(any) to arguments without value definition
+      scheme_(scheme),
+      context_(context),
+      result_(result),
+      tokens_(context.tokens_),
+      consumed_(context.consumed_),
+      next_(context.next_),
+      positional_tokens_(context.positional_tokens_) {
+      initialize();
+      tokenize(cmdl_args.size(), cmdl_args);
     }
 
-    // Return position, prefix, unprefixed
-    std::tuple<size_t, std::string, std::string> parser::unprefix(const std::string& s) {
-      for (const auto& prefix : scheme_def_.long_prefixes_) {
-        if (s.find(prefix) == 0) {
-          return {prefix.size(), prefix, s.substr(prefix.size(), s.size())};
-        }
+    parser::parser(const compiled_scheme& scheme,
+                   parse_context& context,
+                   parse_result& result,
+                   const size_t args_count,
+                   const char* const args[]) :
+      scheme_(scheme),
+      context_(context),
+      result_(result),
+      tokens_(context.tokens_),
+      consumed_(context.consumed_),
+      next_(context.next_),
+      positional_tokens_(context.positional_tokens_) {
+      initialize();
+      tokenize(args_count, args);
+    }
+
+    parser::parser(const compiled_scheme& scheme,
+                   parse_context& context,
+                   parse_result& result,
+                   const size_t args_count,
+                   const std::string_view args[]) :
+      scheme_(scheme),
+      context_(context),
+      result_(result),
+      tokens_(context.tokens_),
+      consumed_(context.consumed_),
+      next_(context.next_),
+      positional_tokens_(context.positional_tokens_) {
+      initialize();
+      tokenize(args_count, args);
+    }
+
+    void parser::initialize() {
+      context_.reset(scheme_.size());
+      result_.scheme_ = &scheme_;
+      context_.fill(result_.values_, scheme_.size(), std::vector<std::string_view>());
+      context_.fill(result_.positions_, scheme_.size(), std::vector<parse_result::position>());
+      result_.converted_.reset();
+      context_.fill(result_.slots_, scheme_.names_count(), compiled_scheme::npos);
+      result_.positionals_.clear();
+    }
+
+    std::string_view parser::match_prefix(const std::string_view& s, const std::vector<std::string>& prefixes) {
+      for (const auto& prefix : prefixes) {
+        if (s.substr(0, prefix.size()) == prefix) return std::string_view(s.data(), prefix.size());
       }
-      for (const auto& prefix : scheme_def_.short_prefixes_) {
-        if (s.find(prefix) == 0) {
-          return {prefix.size(), prefix, s.substr(prefix.size(), s.size())};
+      return std::string_view();
+    }
+
+    void parser::add_token(const token& t) {
+      const size_t idx = tokens_.size();
+      context_.append(tokens_, t);
+      if (t.kind == token::KIND::POSITIONAL) context_.append(positional_tokens_, idx);
+      if (t.name_id != compiled_scheme::npos) {
+        for (const auto& a : scheme_.named_nodes(t.name_id)) {
+          if (!scheme_[a].is_positional) {
+            auto& q = context_.named_tokens_[scheme_[a].parent];
+            if ((q.size() == 0) || (q.back() != idx)) context_.append(q, idx);
+          }
         }
       }
-      return {0, "", s};
     }
 
-    bool parser::is_prefixed(const std::string& s, const std::vector<std::string>& prefixes) {
-      for (const auto& prefix : prefixes) {
-        if (s.find(prefix) == 0) return true;
-      }
-      return false;
+    void parser::consume(const size_t token) {
+      consumed_[token] = true;
+      next_[token] = token + 1;
+      --tokens_left_;
     }
 
-    bool parser::is_long_prefixed(const std::string& s) const {
-      return is_prefixed(s, scheme_def_.long_prefixes_);
+    size_t parser::next_unconsumed(const size_t idx) {
+      size_t found = idx;
+      while ((found < tokens_.size()) && consumed_[found]) found = next_[found];
+      // Shorten the followed links
+      for (size_t i = idx; (i < tokens_.size()) && consumed_[i]; ) {
+        const size_t next = next_[i];
+        next_[i] = found;
+        i = next;
+      }
+      return found;
     }
-      
-    bool parser::is_short_prefixed(const std::string& s) const {
-      return is_prefixed(s, scheme_def_.short_prefixes_);
+
+    std::vector<parser::token> parser::unconsumed() const {
+      std::vector<token> rslt;
+      for (size_t i = 0; i < tokens_.size(); ++i) {
+        if (!consumed_[i]) rslt.push_back(tokens_[i]);
+      }
+      return rslt;
     }
 
-    const std::string& parser::main_value(const entity_ptr& arg_def, const std::string& s) {
-      for (const auto& c : arg_def->pending_) {
-        if ((c->kind_ == entity::KIND::VALUE) && c->known_values_) {
-          const auto& known_values = *c->known_values_;
-          auto found = std::find(known_values.begin(), known_values.end(), s);
-          if (found != known_values.end()) {
-            return *known_values.begin();
+    template <typename Args>
+    void parser::tokenize(const size_t args_count, const Args& args) {
+      OPTSPP_STATS(parse_context::stats_timer timer(context_.stats_.preprocess_time);)
+      context_.reserve(tokens_, args_count);
+      bool terminated = false;
+      for (size_t i = 0; i < args_count; ++i) {
+        const std::string_view arg(args[i]);
+        token t;
+        t.pos_arg_num = i;
+        t.pos_in_arg = 0;
+        if (!terminated) {
+          if (std::find(scheme_.take_as_positionals_args_.begin(),
+                        scheme_.take_as_positionals_args_.end(), arg) != scheme_.take_as_positionals_args_.end()) {
+            // Everything after terminator is positional
+            terminated = true;
+            continue;
+          }
+          t.prefix = match_prefix(arg, scheme_.long_prefixes_);
+          if (t.prefix.size() > 0) {
+            t.kind = token::KIND::LONG;
+          } else {
+            t.prefix = match_prefix(arg, scheme_.short_prefixes_);
+            // Lone short prefix, e.g. '-', is taken as positional
+            if ((t.prefix.size() > 0) && (t.prefix.size() < arg.size())) t.kind = token::KIND::SHORT;
+          }
+        }
+        if (t.kind == token::KIND::POSITIONAL) {
+          t.prefix = std::string_view();
+          t.value = arg;
+          t.has_value = true;
+          add_token(t);
+          continue;
+        }
+        // Split name and value with the first separator found
+        const std::string_view rest = arg.substr(t.prefix.size());
+        size_t sep_pos = std::string_view::npos;
+        for (const auto& sep : scheme_.separators_) {
+          auto pos = rest.find(sep);
+          if ((pos != std::string_view::npos) && ((sep_pos == std::string_view::npos) || (pos < sep_pos))) {
+            sep_pos = pos;
+            t.separator = rest.substr(pos, sep.size());
+          }
+        }
+        if (sep_pos != std::string_view::npos) {
+          t.name = rest.substr(0, sep_pos);
+          t.value = rest.substr(sep_pos + t.separator.size());
+          t.has_value = true;
+        } else {
+          t.name = rest;
+        }
+        if (t.kind == token::KIND::LONG) {
+          t.name_id = scheme_.name_id(t.name);
+          if ((t.name_id == compiled_scheme::npos) && scheme_.allow_abbreviations_ && (t.name.size() > 0)) {
+            std::vector<size_t> candidates;
+            t.name_id = scheme_.abbreviated_name_id(t.name, candidates);
+            if ((candidates.size() > 0) && !failed()) {
+              candidates_ = std::move(candidates);
+              fail(error_code::AMBIGUOUS_ABBREVIATION, compiled_scheme::npos, tokens_.size());
+            }
+          }
+          add_token(t);
+        } else if (t.name.size() <= 1) {
+          if (t.name.size() == 1) t.name_id = scheme_.name_id(t.name[0]);
+          t.pos_in_arg = t.prefix.size();
+          add_token(t);
+        } else {
+          // Expand short options cluster, e.g. -rf to -r -f; attached value belongs to the last one
+          for (size_t j = 0; j < t.name.size(); ++j) {
+            token c(t);
+            c.pos_in_arg = t.prefix.size() + j;
+            c.name = t.name.substr(j, 1);
+            c.name_id = scheme_.name_id(c.name[0]);
+            if (j + 1 < t.name.size()) {
+              c.separator = std::string_view();
+              if ((c.name_id != compiled_scheme::npos) && scheme_.requires_value(c.name_id)) {
+                // The rest of the argument is the value, e.g. -ofile or -vofile
+                c.value = arg.substr(t.prefix.size() + j + 1);
+                c.has_value = true;
+                add_token(c);
+                break;
+              }
+              c.value = std::string_view();
+              c.has_value = false;
+            }
+            add_token(c);
           }
         }
       }
-      return s;
+      context_.fill(consumed_, tokens_.size(), false);
+      context_.fill(next_, tokens_.size(), 0);
+      tokens_left_ = tokens_.size();
     }
 
-    void parser::add_value(const entity_ptr& arg_def, const std::string& s) {
-      auto& v = scheme_def_.values_[arg_def];
-      v.push_back(main_value(arg_def, s));
+    parse_context::COLOR parser::color(const size_t idx) const {
+      return context_.color(idx);
     }
-  
-    void parser::add_positional_value(const entity_ptr& arg_def, const parser::token& t) {
-      add_value(arg_def, t.s);
-      positionals_tmp_.push_back({arg_def, t});
+
+    parse_context::COLOR parser::color(const entity_ptr& e) const {
+      return color(e.get());
     }
 
-    void parser::add_value_implicit(entity_ptr& arg_def, const token& token) {
-      if (arg_def->implicit_values_) {
-        auto& iv = *arg_def->implicit_values_;
-        if (iv.size() > 0) {
-          add_value(arg_def, main_value(arg_def, iv[0]));
-          iv.erase(iv.begin());
-          return;
+    parse_context::COLOR parser::color(const entity* e) const {
+      return context_.color(scheme_.index_of(e));
+    }
+
+    size_t parser::find_value(const size_t arg_def, const std::string_view& s, const bool only_known_value) const {
+      auto known = scheme_.find_known_value(arg_def, s);
+      if (known != nullptr) return known->node;
+      if (!only_known_value) return scheme_[arg_def].any_value;
+      return compiled_scheme::npos;
+    }
+
+    std::string_view parser::main_value(const size_t arg_def, const std::string_view& s) const {
+      auto known = scheme_.find_known_value(arg_def, s);
+      if (known != nullptr) return known->main;
+      return s;
+    }
+
+    void parser::add_value(const size_t arg_def, const std::string_view& s, const token& t) {
+      auto& v = result_.values_[arg_def];
+      context_.append(v, main_value(arg_def, s));
+      context_.append(result_.positions_[arg_def], parse_result::position{t.pos_arg_num, t.pos_in_arg});
+      // Name lookups resolve to the first node in scheme order that has values
+      if (v.size() == 1) {
+        for (const auto& id : scheme_.node_names(arg_def)) {
+          auto& slot = result_.slots_[id];
+          if ((slot == compiled_scheme::npos) || (slot > arg_def)) slot = arg_def;
         }
       }
-      throw no_implicit_value(arg_def);
     }
 
-    void parser::add_value_default(entity_ptr& arg_def, const parser::token& token) {
-      if (arg_def->default_values_) {
-        auto& iv = *arg_def->default_values_;
-        if (iv.size() > 0) {
-          add_value(arg_def, main_value(arg_def, iv[0]));
-          iv.erase(iv.begin());
+    void parser::add_positional_value(const size_t arg_def, const parser::token& t) {
+      add_value(arg_def, t.value, t);
+      context_.append(context_.positionals_, std::make_pair(arg_def, t.pos_arg_num));
+    }
+
+    bool parser::has_implicit_value(const size_t arg_def) const {
+      const auto& e = scheme_[arg_def].source;
+      return e->implicit_values() && (context_.implicit_taken_[arg_def] < (*e->implicit_values()).size());
+    }
+
+    void parser::add_value_implicit(const size_t arg_def, const token& token) {
+      auto& taken = context_.implicit_taken_[arg_def];
+      add_value(arg_def, (*scheme_[arg_def].source->implicit_values())[taken], token);
+      ++taken;
+    }
+
+    void parser::add_value_default(const size_t arg_def, const parser::token& token) {
+      const auto& e = scheme_[arg_def].source;
+      if (e->default_values()) {
+        auto& iv = *e->default_values();
+        auto& taken = context_.default_taken_[arg_def];
+        if (taken < iv.size()) {
+          add_value(arg_def, iv[taken], token);
+          ++taken;
           return;
         }
       }
       //TODO     throw (arg_def);
     }
 
-    void parser::consume_named_value(entity_ptr& arg_def,
-                                     const std::list<token>::iterator& token) {
-      // Check if we don't have more tokens.
-      if (tokens_.size() == 1) {
-        add_value_implicit(arg_def, *token);
-        tokens_.erase(token);
-        return;
+    bool parser::consume_named_value(const size_t arg_def,
+                                     const size_t token) {
+      const auto& t = tokens_[token];
+      // Value attached with separator, e.g. --name=value
+      if (t.has_value) {
+        const size_t found = find_value(arg_def, t.value, false);
+        if (found == compiled_scheme::npos) return fail(error_code::CONSUME_VALUE_FAILED, arg_def, token);
+        if (context_.blocked(found)) return fail(error_code::VALUE_CONFLICT, arg_def, token);
+        move_border(arg_def, found);
+        add_value(arg_def, t.value, t);
+        consume(token);
+        return true;
       }
 
       // Continue looking for value in the next token.
-      std::list<parser::token>::iterator next_it(token);
-      ++next_it;
-      // Next token is a new option
-      if ((is_long_prefixed(next_it->s) ||
-           is_short_prefixed(next_it->s)) &&
-          !ignore_option_prefixes_) {
-        add_value_implicit(arg_def, *token);
-        tokens_.erase(token);
-        return;
+      const size_t next = tokens_left_ == 1 ? tokens_.size() : next_unconsumed(token + 1);
+      // No more tokens, or next token is a new option
+      if ((next == tokens_.size()) || (tokens_[next].kind != token::KIND::POSITIONAL)) {
+        if (!has_implicit_value(arg_def)) return fail(error_code::NO_IMPLICIT_VALUE, arg_def, token);
+        add_value_implicit(arg_def, t);
+        consume(token);
+        return true;
       }
       // Next token must be our the value
       // Find value entity that matches actual value
-      auto& val_siblings = arg_def->pending_;
-      auto found = find_if(val_siblings.begin(), val_siblings.end(), [&next_it] (const entity_ptr& e) {
-          if ((e->kind_ == entity::KIND::VALUE) && (e->known_values_)) {
-            auto& known_values = *e->known_values_;
-            auto found_value = find_if(known_values.begin(), known_values.end(), [&next_it] (const std::string& s) {
-                return s == next_it->s;
-              });
-            return found_value != known_values.end();
-          } else {
-            return false;
-          }
-        });
-      if (found == val_siblings.end()) {
-        found = find_if(val_siblings.begin(), val_siblings.end(), [] (const entity_ptr& e) {
-            return e->any_value_ && *(e->any_value_);
-          });
-      }
-      if (found != val_siblings.end()) {
-        if ((*found)->color_ != entity::COLOR::BLOCKED) {
-          move_border(arg_def, *found);
-          add_value(arg_def, next_it->s);
+      const auto& v = tokens_[next];
+      const size_t found = find_value(arg_def, v.value, false);
+      if (found != compiled_scheme::npos) {
+        if (!context_.blocked(found)) {
+          move_border(arg_def, found);
+          add_value(arg_def, v.value, v);
           // Remove tokens containing name and value
-          tokens_.erase(tokens_.erase(token));
-          return;
+          consume(token);
+          consume(next);
+          return true;
         } else {
-          throw value_conflict(arg_def, next_it->s);
-        }
-      } else {
-        try {
-          add_value_implicit(arg_def, *token);
-          tokens_.erase(token);
-          return;
-        } catch (...) {
+          return fail(error_code::VALUE_CONFLICT, arg_def, next);
         }
+      } else if (has_implicit_value(arg_def)) {
+        add_value_implicit(arg_def, t);
+        consume(token);
+        return true;
       }
-      throw consume_value_failed(arg_def);
-    }
-
-    bool parser::consume_positional(entity_ptr& arg_def,
-                                                const std::list<token>::iterator& token,
-                                                const bool only_known_value) {
-      if (arg_def->is_positional_ && *arg_def->is_positional_) {
-        if (!ignore_option_prefixes_ &&
-            (is_prefixed(token->s, scheme_def_.long_prefixes_) ||
-             is_prefixed(token->s, scheme_def_.short_prefixes_))) return false;
-        std::vector<entity_ptr>& val_siblings = arg_def->pending_;
-        while (true) {
-          auto& val_siblings = arg_def->pending_;
-          auto found = find_if(val_siblings.begin(), val_siblings.end(), [&token] (const entity_ptr& e) {
-              if ((e->kind_ == entity::KIND::VALUE) && (e->known_values_)) {
-                auto& known_values = *e->known_values_;
-                auto found_value = find_if(known_values.begin(), known_values.end(), [&token] (const std::string& s) {
-                    return s == token->s;
-                  });
-                return found_value != known_values.end();
-              } else {
-                return false;
-              }
-            });
-          if ((!only_known_value) && (found == val_siblings.end())) {
-            found = find_if(val_siblings.begin(), val_siblings.end(), [&token] (const entity_ptr& e) {
-                return (e->kind_ == entity::KIND::VALUE) && e->is_any_value() && *e->is_any_value();
-              });
-          }
-          if (found != val_siblings.end()) {
-            if ((*found)->color_ != entity::COLOR::BLOCKED) {
-              move_border(arg_def, *found);
-              add_positional_value(arg_def, *token);
-              // Remove tokens containing name and value
-              tokens_.erase(token);
-              return true;
-            } else {
-              throw value_conflict(arg_def, token->s);
-            }
+      return fail(error_code::CONSUME_VALUE_FAILED, arg_def, token);
+    }
+
+    bool parser::consume_positional(const size_t arg_def,
+                                    const size_t token,
+                                    const bool only_known_value) {
+      const auto& a = scheme_[arg_def];
+      const auto& t = tokens_[token];
+      if (a.is_positional && (t.kind == token::KIND::POSITIONAL)) {
+        const size_t found = find_value(arg_def, t.value, only_known_value);
+        if (found != compiled_scheme::npos) {
+          if (!context_.blocked(found)) {
+            move_border(arg_def, found);
+            add_positional_value(arg_def, t);
+            // Remove tokens containing name and value
+            consume(token);
+            return true;
           } else {
-            break;
+            return fail(error_code::VALUE_CONFLICT, arg_def, token);
           }
         }
       }
       return false;
     }
 
-    std::list<parser::token>::iterator parser::find_token_for_named(const entity_ptr& arg_def) {
-      // Find token that matches argument's definition by long name
-      for (auto t = tokens_.begin(); t != tokens_.end(); ++t) {
-        auto up = unprefix(t->s);
-        auto& prefix = std::get<1>(up);
-        auto& name = std::get<2>(up);
-        if ((scheme_def_.is_long_prefix(prefix)) && (arg_def->name_matches(name))) {
-          return t;
-        }
-        if (scheme_def_.is_short_prefix(prefix)) {
-          size_t pos = std::get<0>(up);
-          if (name.size() > 1) {
-            for (const auto& short_name : name) {
-              parser::token new_token{t->pos_arg_num, pos, scheme_def_.short_prefixes_[0] + short_name};
-              tokens_.insert(t, new_token);
-              ++pos;
-            }
-            tokens_.erase(t);
-            t = tokens_.begin();
-          } else {
-            if (arg_def->name_matches(name[0]))
-              return t;
+    size_t parser::find_token_for_named(const size_t parent, size_t& arg_def) {
+      // Consumed tokens and tokens naming only blocked arguments can't be taken later, skip them for good
+      auto& q = context_.named_tokens_[parent];
+      auto& cursor = context_.named_cursor_[parent];
+      for (; cursor < q.size(); ++cursor) {
+        ++context_.counters_.tokens_scanned;
+        const size_t t = q[cursor];
+        if (consumed_[t]) continue;
+        for (const auto& a : scheme_.named_nodes(tokens_[t].name_id)) {
+          const auto& n = scheme_[a];
+          if ((n.parent == parent) &&
+              !n.is_positional &&
+              (!context_.blocked(a))) {
+            arg_def = a;
+            return t;
           }
         }
       }
-      return tokens_.end();
-    }
-
-    bool parser::consume_argument(entity_ptr& parent) {
-      auto& arg_siblings = parent->pending_;
-      if (!ignore_option_prefixes_) {
-        // Find matching argument
-        for (auto& arg_def : arg_siblings) {
-          if ((arg_def->kind_ == entity::KIND::ARGUMENT) &&
-              (arg_def->color_ != entity::COLOR::BLOCKED) &&
-              (arg_def->is_positional_ && !*arg_def->is_positional_)) {
-            auto t = find_token_for_named(arg_def);
-            if (t != tokens_.end()) {
-              move_border(parent, arg_def);
-              consume_named_value(arg_def, t);
-              return true;
-            }
-          }
-        }
+      return compiled_scheme::npos;
+    }
+
+    bool parser::may_be_option_value(const size_t token) const {
+      if (token == 0) return false;
+      const auto& o = tokens_[token - 1];
+      return !consumed_[token - 1] && (o.kind != token::KIND::POSITIONAL) && !o.has_value;
+    }
+
+    bool parser::consume_argument(const size_t parent) {
+      const auto& p = scheme_[parent];
+      // Find matching argument
+      size_t arg_def;
+      auto t = find_token_for_named(parent, arg_def);
+      if (t != compiled_scheme::npos) {
+        move_border(parent, arg_def);
+        return consume_named_value(arg_def, t);
       }
       // Positional
-      for (auto& arg_def : arg_siblings) {
-        if ((arg_def->kind_ == entity::KIND::ARGUMENT) &&
-            (arg_def->color_ != entity::COLOR::BLOCKED) &&
-            (arg_def->is_positional_ && *arg_def->is_positional_)) {
-          auto& val_siblings = arg_def->pending_;
-          move_border(parent, arg_def);
-          for (auto& val_def : val_siblings) {
-            if ((val_def->kind_ == entity::KIND::VALUE) &&
-                (val_def->color_ != entity::COLOR::BLOCKED)
-                //&& (val_def->any_value_ && (*val_def->any_value_ == false))
-                ) {
-              for (auto t = tokens_.begin(); t != tokens_.end(); ++t) {
-                if ((std::get<1>(unprefix(t->s)) == "") || (ignore_option_prefixes_)) {
-                  if (val_def->value_matches(t->s)) {
-                    consume_positional(arg_def, t, false);
-                    return true;
-                  }
-                }
-              }
-            }
+      while ((positional_cursor_ < positional_tokens_.size()) && consumed_[positional_tokens_[positional_cursor_]]) {
+        ++context_.counters_.tokens_scanned;
+        ++positional_cursor_;
+      }
+      for (size_t i = p.first_positional; i < p.first_positional + p.positionals_count; ++i) {
+        const size_t arg_def = scheme_.positional_children_[i];
+        ++context_.counters_.nodes_visited;
+        if (context_.blocked(arg_def)) continue;
+        const auto& a = scheme_[arg_def];
+        move_border(parent, arg_def);
+        // Each token is resolved to a value by a hash lookup. A token that no open value of the argument
+        // takes never will be, so the argument scans the tokens once.
+        auto& cursor = context_.arg_cursor_[arg_def];
+        if (cursor < positional_cursor_) cursor = positional_cursor_;
+        for (; cursor < positional_tokens_.size(); ++cursor) {
+          ++context_.counters_.tokens_scanned;
+          const size_t t = positional_tokens_[cursor];
+          if (consumed_[t]) continue;
+          const size_t found = find_value(arg_def, tokens_[t].value, false);
+          if ((found == compiled_scheme::npos) ||
+              (context_.blocked(found) && ((a.any_value == compiled_scheme::npos) || context_.blocked(a.any_value)))) {
+            continue;
           }
+          // Leave the token to the option before it, the option may not be open yet
+          if (may_be_option_value(t)) break;
+          return consume_positional(arg_def, t, false);
         }
       }
       // Nothing consumed
       return false;
     }
 
-    bool parser::consume_argument_positional_any(entity_ptr& parent) {
-      auto& arg_siblings = parent->pending_;
-      for (auto& arg_def : arg_siblings) {
-        if ((arg_def->kind_ == entity::KIND::ARGUMENT) &&
-            (arg_def->color_ != entity::COLOR::BLOCKED) &&
-            (arg_def->is_positional_ && *arg_def->is_positional_)) {
-          auto& val_siblings = arg_def->pending_;
+    bool parser::consume_argument_positional_any(const size_t parent) {
+      const auto& p = scheme_[parent];
+      for (size_t i = p.first_positional; i < p.first_positional + p.positionals_count; ++i) {
+        const size_t arg_def = scheme_.positional_children_[i];
+        const auto& a = scheme_[arg_def];
+        if (!context_.blocked(arg_def)) {
           move_border(parent, arg_def);
-          for (auto& val_def : val_siblings) {
-            if ((val_def->kind_ == entity::KIND::VALUE) &&
-                (val_def->color_ != entity::COLOR::BLOCKED) &&
-                (val_def->any_value_ && (*val_def->any_value_))) {
-              //              consume_positional(arg_def, t, false);
+          for (size_t val_def = a.first_child; val_def < a.first_child + a.children_count; ++val_def) {
+            if ((scheme_[val_def].kind == entity::KIND::VALUE) &&
+                (!context_.blocked(val_def)) &&
+                scheme_[val_def].is_any_value) {
               return true;
             }
           }
@@ -308,120 +424,191 @@ namespace optspp {
       }
       return false;
     }
-    
-    void parser::clear_color(entity_ptr& e) {
-      if (e->color_ == entity::COLOR::VISITED)
-        e->color_ = entity::COLOR::BORDER;
-      for (auto& c : e->pending_) clear_color(c);
+
+    void parser::open(const size_t idx) {
+      if (scheme_[idx].has_argument_children) {
+        auto& f = context_.frontier_;
+        context_.append(f, idx);
+        std::push_heap(f.begin(), f.end(), std::greater<size_t>());
+      }
     }
 
     void parser::initialize_pass() {
-      clear_color(scheme_def_.root_);
-      if (scheme_def_.root_->color_ != entity::COLOR::BLOCKED) {
-        scheme_def_.root_->color_ = entity::COLOR::BORDER;
+      for (const auto& idx : context_.visited_) {
+        if (!context_.blocked(idx)) open(idx);
+      }
+      context_.visited_.clear();
+      auto& visited = context_.visited_bits_;
+      std::memset(visited.data(), 0, visited.size() * sizeof(uint64_t));
+      if (!parse_context::test(context_.border_, 0)) {
+        parse_context::set(context_.border_, 0);
+        open(0);
       }
     }
 
-    entity_ptr parser::find_border_entity() const {
-      std::queue<entity_ptr> q;
-      if (scheme_def_.root_->color_ != entity::COLOR::BLOCKED) q.push(scheme_def_.root_);
-      while (q.size() > 0) {
-        auto p = q.front();
-        q.pop();
-        if (p->color_ == entity::COLOR::BORDER) {
-          for (const auto& e : p->pending_) {
-            if ((e->kind_ == entity::KIND::ARGUMENT) && (e->color_ != entity::COLOR::VISITED)) {
-              p->color_ = entity::COLOR::VISITED;
-              return p;
-            }
-          }
+    // Nodes only open their own children or block siblings of those, so within a pass border
+    // nodes are taken in scheme (breadth-first) order and every open node is taken once.
+    size_t parser::find_border_entity() {
+      auto& f = context_.frontier_;
+      while (f.size() > 0) {
+        std::pop_heap(f.begin(), f.end(), std::greater<size_t>());
+        const size_t idx = f.back();
+        f.pop_back();
+        ++context_.counters_.nodes_visited;
+        // Skip blocked nodes and duplicates
+        if (!context_.blocked(idx) && !parse_context::test(context_.visited_bits_, idx)) {
+          parse_context::set(context_.visited_bits_, idx);
+          context_.append(context_.visited_, idx);
+          return idx;
         }
-        for (const auto& c : p->pending_) q.push(c);
       }
-      return nullptr;
+      return compiled_scheme::npos;
     }
 
-    void parser::move_border(entity_ptr& parent, entity_ptr& child) {
-      if (child->kind_ == entity::KIND::VALUE) {
-        if (child->known_values_) {
-          for (const auto& s : *child->known_values_) {
-          }
-        }
-      }
-      child->color_ = entity::COLOR::BORDER;
-      if (child->siblings_group_ == SIBLINGS_GROUP::XOR) {
-        //        parent->color_ = entity::COLOR::VISITED;
-        for (auto& s : parent->pending_) {
-          if ((s != child) && (s->kind_ == child->kind_) && (s->siblings_group_ == SIBLINGS_GROUP::XOR)) {
-            if (s->kind_ == entity::KIND::VALUE) {
-              if (s->known_values_) {
-                for (const auto& ss : *s->known_values_) {
-                }
-              }
-            }
-            
-            s->color_ = entity::COLOR::BLOCKED;
-          }
-        }
-      }
-      if (child->siblings_group_ == SIBLINGS_GROUP::OR) {
-        //  parent->color_ = entity::COLOR::VISITED;
+    void parser::move_border(const size_t, const size_t child) {
+      parse_context::set(context_.border_, child);
+      open(child);
+      const size_t group = scheme_[child].xor_group;
+      if (group != compiled_scheme::npos) {
+        const auto& g = scheme_.xor_groups_[group];
+        const uint64_t* mask = scheme_.xor_masks_.data() + g.offset;
+        uint64_t* blocked = context_.blocked_.data() + g.first_word;
+        for (size_t w = 0; w < g.words_count; ++w) blocked[w] |= mask[w];
+        parse_context::clear(context_.blocked_, child);
       }
     }
 
     bool parser::pass_tree() {
+      ++context_.counters_.passes;
       bool rslt = false;
       initialize_pass();
 
       while (true) {
         auto parent = find_border_entity();
-        if (parent == nullptr) {
+        if (parent == compiled_scheme::npos) {
           // No more parents found
           return rslt;
         }
-        if (consume_argument(parent)) {
-          rslt = true;
-        }
+        // Drain the node, it takes all the tokens it can in this pass
+        while (consume_argument(parent)) rslt = true;
+        if (failed()) return false;
       }
       return rslt;
     }
-    
+
     // Parse
     void parser::parse() {
-      scheme_def_.values_.clear();
-      scheme_def_.positionals_.clear();
+      if (!try_parse()) error().raise();
+    }
 
+    bool parser::try_parse() {
+      OPTSPP_STATS(parse_context::stats_timer timer(context_.stats_.passes_time);)
+      // Tokenizer failed
+      if (failed()) return false;
       while (true) {
         // If we still have unparsed data
-        if (tokens_.size() > 0) {
+        if (tokens_left_ > 0) {
           if (!pass_tree()) {
-            throw unparsed_tokens(tokens_);
+            if (!failed()) fail(error_code::UNPARSED_TOKENS, compiled_scheme::npos, next_unconsumed(0));
+            return false;
           }
         } else {
           // Success
           break;
         }
       }
-      
-      std::sort(positionals_tmp_.begin(), positionals_tmp_.end(),
-                [] (const std::pair<entity_ptr, token>& a,
-                    const std::pair<entity_ptr, token>& b) {
-                  return (a.second.pos_arg_num < b.second.pos_arg_num);
+
+      auto& positionals = context_.positionals_;
+      std::sort(positionals.begin(), positionals.end(),
+                [] (const std::pair<size_t, size_t>& a,
+                    const std::pair<size_t, size_t>& b) {
+                  return (a.second < b.second);
                 });
-      scheme_def_.positionals_.clear();
-      for (const auto& p : positionals_tmp_) {
-        scheme_def_.positionals_.push_back(p.first);
+      result_.positionals_.clear();
+      for (const auto& p : positionals) {
+        context_.append(result_.positionals_, p.first);
       }
-      
+
       //TODO: Check if all parents for dead-ends
-      
+
+      return true;
+    }
+
+    void parser::min_value_check(std::vector<actual_counts_mismatch::record>& acc, const size_t idx) const {
+      if (!context_.blocked(idx)) {
+        const auto& n = scheme_[idx];
+        if (n.source->min_count()) {
+          const auto& vs = result_.values_[idx];
+          if (vs.size() < *n.source->min_count()) acc.push_back({n.source, vs.size()});
+        }
+        for (size_t c = n.first_child; c < n.first_child + n.children_count; ++c) min_value_check(acc, c);
+      }
+    }
+
+    void parser::validate_results() {
+      if (!try_validate_results()) error().raise();
+    }
+
+    bool parser::try_validate_results() {
+      OPTSPP_STATS(parse_context::stats_timer timer(context_.stats_.validate_time);)
+      auto& acc = mismatches_;
+      acc.clear();
+      const auto& root = scheme_[0];
+      for (size_t c = root.first_child; c < root.first_child + root.children_count; ++c) {
+        min_value_check(acc, c);
+      }
+      for (size_t i = 0; i < scheme_.size(); ++i) {
+        const auto& e = scheme_[i].source;
+        const auto& vs = result_.values_[i];
+        if (e->max_count() && (vs.size() > *e->max_count())) {
+          acc.push_back({e, vs.size()});
+        }
+      }
+      if (acc.size() > 0) return fail(error_code::ACTUAL_COUNTS_MISMATCH, compiled_scheme::npos, compiled_scheme::npos);
+      return true;
+    }
+
+    bool parser::fail(const error_code code, const size_t node, const size_t token) {
+      error_ = code;
+      error_node_ = node;
+      error_token_ = token;
+      return false;
+    }
+
+    bool parser::failed() const {
+      return error_ != error_code::NONE;
+    }
+
+    parse_error parser::error() const {
+      parse_error rslt;
+      rslt.code = error_;
+      if (error_node_ != compiled_scheme::npos) rslt.entity = scheme_[error_node_].source;
+      if (error_token_ < tokens_.size()) {
+        const auto& t = tokens_[error_token_];
+        rslt.pos_arg_num = t.pos_arg_num;
+        rslt.pos_in_arg = t.pos_in_arg;
+        if (error_ == error_code::VALUE_CONFLICT) rslt.value = std::string(t.value);
+        if (error_ == error_code::AMBIGUOUS_ABBREVIATION) rslt.value = std::string(t.name);
+      }
+      if (error_ == error_code::UNPARSED_TOKENS) {
+        rslt.unparsed_ = unconsumed();
+      }
+      if (error_ == error_code::AMBIGUOUS_ABBREVIATION) {
+        for (const auto& c : candidates_) rslt.candidates.push_back(scheme_[c].source);
+        rslt.entity = rslt.candidates[0];
+      }
+      if (error_ == error_code::ACTUAL_COUNTS_MISMATCH) {
+        rslt.records = mismatches_;
+        rslt.entity = mismatches_[0].entity;
+      }
+      return rslt;
     }
 
     /*
       TODO: move this to after parsing func
       // Insert it as default value if available
-      add_value_default(arg_def, *token);
-      tokens_.erase(token);
+      add_value_default(arg_def, tokens_[token]);
+      consume(token);
       arg_matched_long = true;*/
   }
 }
@@ -1,17 +1,26 @@
 #pragma once
 
+#include <initializer_list>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace optspp {
   namespace scheme {
     struct definition;
     struct entity;
+    struct arena;
+    struct compiled_scheme;
+    struct parse_result;
+    struct parse_context;
 
-    // Scheme element (argument definition, value definition)
+    // Scheme element (argument definition, value definition), keeps the arena the entity lives in alive
     using entity_ptr = std::shared_ptr<entity>;
 
     struct parser;
   }
+  struct response_files;
+
   // Properties
   struct name;
   struct min_count;
@@ -38,15 +47,20 @@ namespace optspp {
   std::shared_ptr<scheme::definition>& operator<<(std::shared_ptr<scheme::definition> d, const std::shared_ptr<scheme::entity>& e);
   // Assign value definition to argument definition and argument definition to value definition; the children are xor-compatible
   scheme::entity_ptr operator<<(scheme::entity_ptr lhs, const scheme::entity_ptr& rhs);
+  scheme::entity_ptr operator<<(scheme::entity_ptr lhs, scheme::entity_ptr&& rhs);
   // Assign value definition to argument definition and argument definition to value definition; the children are or-compatible
   scheme::entity_ptr operator|(scheme::entity_ptr lhs, const scheme::entity_ptr& rhs);
+  scheme::entity_ptr operator|(scheme::entity_ptr lhs, scheme::entity_ptr&& rhs);
   // Assign argument definition to scheme definition; the children are or-compatible
   scheme::definition& operator<<(scheme::definition& lhs, const std::shared_ptr<scheme::entity>& rhs);  
+  scheme::definition& operator<<(scheme::definition& lhs, std::shared_ptr<scheme::entity>&& rhs);
   // Assign argument definition to scheme definition; the children are or-compatible
   scheme::definition& operator|(scheme::definition& lhs, const std::shared_ptr<scheme::entity>& rhs);
+  scheme::definition& operator|(scheme::definition& lhs, std::shared_ptr<scheme::entity>&& rhs);
 
   // Exceptions
   struct optspp_error;
   struct actual_counts_mismatch;
+  struct parse_error;
   
 }
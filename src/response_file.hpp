@@ -0,0 +1,54 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace optspp {
+  // Command line with GCC-style @file arguments replaced by the arguments read from the files.
+  // Arguments are separated by whitespace, may be quoted with ' or " and escaped with \.
+  // Files are memory-mapped and arguments view the mappings; only quoted or escaped arguments are copied.
+  // Arguments of files that can not be read are kept as is, @file arguments within files are expanded too.
+  struct response_files {
+    // argv[0] is skipped like in compiled_scheme::parse(argc, argv)
+    response_files(const int argc, const char* const argv[], const std::string& prefix = "@");
+    response_files(const std::vector<std::string_view>& args, const std::string& prefix = "@");
+    response_files(const response_files&) = delete;
+    response_files& operator=(const response_files&) = delete;
+    response_files(response_files&&) = default;
+    response_files& operator=(response_files&&) = default;
+
+    // Expanded arguments, valid as long as this object lives
+    const std::vector<std::string_view>& args() const;
+
+    // Maximum depth of @file arguments within files
+    static constexpr size_t max_depth = 64;
+
+  private:
+    // Read-only view of a whole file, memory-mapped where supported
+    struct file {
+      file(const std::string& path);
+      file(const file&) = delete;
+      file& operator=(const file&) = delete;
+      ~file();
+
+      bool is_open{false};
+      std::string_view data;
+    private:
+      void* mapping_{nullptr};
+      size_t mapping_size_{0};
+      std::string buffer_;
+    };
+
+    std::string prefix_;
+    std::vector<std::unique_ptr<file>> files_;
+    // Unquoted copies of quoted or escaped arguments, deque keeps them in place
+    std::deque<std::string> copies_;
+    std::vector<std::string_view> args_;
+
+    void add(const std::string_view& arg, const size_t depth);
+    void expand(const std::string_view& data, const size_t depth);
+  };
+}
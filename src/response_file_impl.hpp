@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cctype>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define OPTSPP_MMAP
+#endif
+
+#include "response_file.hpp"
+#include "exception.hpp"
+
+namespace optspp {
+  response_files::file::file(const std::string& path) {
+#ifdef OPTSPP_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if ((::fstat(fd, &st) == 0) && S_ISREG(st.st_mode)) {
+      is_open = true;
+      if (st.st_size > 0) {
+        void* m = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+          mapping_ = m;
+          mapping_size_ = static_cast<size_t>(st.st_size);
+          data = std::string_view(static_cast<const char*>(m), mapping_size_);
+        } else {
+          is_open = false;
+        }
+      }
+    }
+    ::close(fd);
+#else
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return;
+    buffer_.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    is_open = true;
+    data = buffer_;
+#endif
+  }
+
+  response_files::file::~file() {
+#ifdef OPTSPP_MMAP
+    if (mapping_ != nullptr) ::munmap(mapping_, mapping_size_);
+#endif
+  }
+
+  response_files::response_files(const int argc, const char* const argv[], const std::string& prefix) :
+    prefix_(prefix) {
+    for (int i = 1; i < argc; ++i) add(argv[i], 0);
+  }
+
+  response_files::response_files(const std::vector<std::string_view>& args, const std::string& prefix) :
+    prefix_(prefix) {
+    args_.reserve(args.size());
+    for (const auto& a : args) add(a, 0);
+  }
+
+  const std::vector<std::string_view>& response_files::args() const {
+    return args_;
+  }
+
+  void response_files::add(const std::string_view& arg, const size_t depth) {
+    if ((prefix_.size() == 0) || (arg.size() <= prefix_.size()) || (arg.substr(0, prefix_.size()) != prefix_)) {
+      args_.push_back(arg);
+      return;
+    }
+    if (depth >= max_depth) OPTSPP_THROW(response_file_error(std::string(arg.substr(prefix_.size())), "nested too deep"));
+    auto f = std::make_unique<file>(std::string(arg.substr(prefix_.size())));
+    if (!f->is_open) {
+      args_.push_back(arg);
+      return;
+    }
+    const auto data = f->data;
+    files_.push_back(std::move(f));
+    expand(data, depth + 1);
+  }
+
+  void response_files::expand(const std::string_view& data, const size_t depth) {
+    size_t i = 0;
+    while (i < data.size()) {
+      if (std::isspace(static_cast<unsigned char>(data[i]))) {
+        ++i;
+        continue;
+      }
+      // Plain argument is taken as a view, quotes or escapes make it a copy
+      const size_t first = i;
+      while ((i < data.size()) && !std::isspace(static_cast<unsigned char>(data[i])) &&
+             (data[i] != '\'') && (data[i] != '"') && (data[i] != '\\')) ++i;
+      if ((i == data.size()) || std::isspace(static_cast<unsigned char>(data[i]))) {
+        add(data.substr(first, i - first), depth);
+        continue;
+      }
+      std::string s(data.substr(first, i - first));
+      char quote = 0;
+      for (; i < data.size(); ++i) {
+        const char c = data[i];
+        if ((c == '\\') && (i + 1 < data.size())) {
+          s += data[++i];
+        } else if (quote != 0) {
+          if (c == quote) quote = 0; else s += c;
+        } else if ((c == '\'') || (c == '"')) {
+          quote = c;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+          break;
+        } else {
+          s += c;
+        }
+      }
+      copies_.push_back(std::move(s));
+      add(copies_.back(), depth);
+    }
+  }
+}
@@ -1,14 +1,24 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
 #include <vector>
 
 #include "predeclare.hpp"
 #include "misc.hpp"
-#include "exception.hpp"
 
 namespace optspp {
   namespace scheme {
@@ -18,53 +28,169 @@ namespace optspp {
       XOR        
     };
 
+    // Values taken by a single parse of a compiled scheme. Values view either the parsed arguments
+    // (zero-copy parses), the result's own copy of them, or the scheme's known values.
+    // The result must not outlive the compiled scheme.
+    struct parse_result {
+      const std::vector<std::string_view>& operator[](const std::string_view& name) const;
+      const std::vector<std::string_view>& operator[](const char name) const;
+      std::string_view operator()(const std::string_view& name, const size_t idx) const;
+      std::string_view operator()(const std::string_view& name) const;
+      std::string_view operator()(const char name, const size_t idx) const;
+      std::string_view operator()(const char name) const;
+
+      // Node that holds values for the name, compiled_scheme::npos if none
+      size_t find(const std::string_view& name) const;
+      size_t find(const char name) const;
+      // Values taken by compiled scheme node
+      const std::vector<std::string_view>& values(const size_t idx) const;
+      // Positional argument nodes in command line order
+      const std::vector<size_t>& positionals() const;
+
+      // Value converted with std::from_chars, or copied if T is a string type. Results may be converted
+      // from several threads at once. A value caches its first conversion only: converting it to
+      // another arithmetic type converts again on every call.
+      template <typename T>
+      T get(const std::string_view& name, const size_t idx) const;
+      template <typename T>
+      T get(const std::string_view& name) const;
+      template <typename T>
+      T get(const char name, const size_t idx) const;
+      template <typename T>
+      T get(const char name) const;
+      template <typename T>
+      std::vector<T> get_all(const std::string_view& name) const;
+      template <typename T>
+      std::vector<T> get_all(const char name) const;
+
+      // Command line position of a value; implicit values take the position of their option
+      struct position {
+        size_t pos_arg_num;
+        size_t pos_in_arg;
+      };
+      const std::vector<position>& positions(const size_t idx) const;
+
+      friend struct ::optspp::scheme::parser;
+      friend struct ::optspp::scheme::compiled_scheme;
+      
+    private:
+      const compiled_scheme* scheme_{nullptr};
+      // Parsed arguments kept by the result if the parse was not zero-copy
+      std::shared_ptr<const void> storage_;
+      std::vector<std::vector<std::string_view>> values_;
+      std::vector<size_t> positionals_;
+      // Node holding values by compiled scheme name id
+      std::vector<size_t> slots_;
+      std::vector<std::vector<position>> positions_;
+      // First conversion of each value, filled on demand
+      using converted_value = std::variant<std::monostate,
+                                           short, unsigned short, int, unsigned int,
+                                           long, unsigned long, long long, unsigned long long,
+                                           float, double, long double>;
+      struct conversion {
+        std::once_flag converted;
+        converted_value value;
+      };
+      // Conversions of a node's values, allocated by the first conversion of one of them
+      struct node_conversions {
+        std::once_flag allocated;
+        size_t size{0};
+        std::unique_ptr<conversion[]> values;
+      };
+      // Conversions by compiled scheme node, created by the first conversion so that parses that
+      // don't convert allocate nothing. Copies of a result share it.
+      struct conversion_cache {
+        conversion_cache() = default;
+        conversion_cache(const conversion_cache& other);
+        conversion_cache& operator=(const conversion_cache& other);
+        // Create the cache for nodes_count nodes unless it exists
+        std::shared_ptr<std::vector<node_conversions>> get(const size_t nodes_count) const;
+        void reset();
+      private:
+        // Accessed with the atomic shared_ptr functions
+        mutable std::shared_ptr<std::vector<node_conversions>> nodes_;
+      };
+      conversion_cache converted_;
+
+      size_t slot(const size_t name_id) const;
+      template <typename T>
+      T convert(const size_t node, const size_t idx, const std::string_view& name) const;
+      template <typename T>
+      std::vector<T> convert_all(const size_t node, const std::string_view& name) const;
+    };
+
     struct definition {
       definition();
       void parse(const std::vector<std::string>& cmdl_args);
       void parse(const int argc, char* argv[]);
+      // Parse without throwing, returns the failure if any
+      optional<parse_error> try_parse(const std::vector<std::string>& cmdl_args);
+      // Build flattened representation of the scheme; the definition may be modified afterwards
+      // without affecting the compiled scheme
+      std::shared_ptr<const compiled_scheme> compile() const;
+      // Validate and compile the scheme once and keep it for parse, which then does no validation.
+      // Modifying the definition drops the kept scheme.
+      std::shared_ptr<const compiled_scheme> finalize() const;
+      // Accept unambiguous abbreviations of long names, e.g. --recur for --recursive
+      void allow_abbreviations(const bool allow = true);
       
-      friend struct ::optspp::scheme::parser;
+      friend struct ::optspp::scheme::compiled_scheme;
       // Assign argument definition to scheme definition; the children are or-compatible
       friend definition& optspp::operator<<(definition& lhs, const std::shared_ptr<scheme::entity>& rhs);  
+      friend definition& optspp::operator<<(definition& lhs, std::shared_ptr<scheme::entity>&& rhs);
       // Assign argument definition to scheme definition; the children are or-compatible
       friend definition& optspp::operator|(definition& lhs, const std::shared_ptr<scheme::entity>& rhs);
+      friend definition& optspp::operator|(definition& lhs, std::shared_ptr<scheme::entity>&& rhs);
 
       void validate() const;
-      void validate_results() const;
 
-      const std::vector<std::string>& operator[](const std::string& name) const;
+      const std::vector<std::string>& operator[](const std::string_view& name) const;
       const std::vector<std::string>& operator[](const char name) const;
       const std::vector<std::string>& operator[](const size_t) const;
-      const std::string& operator()(const std::string& name, const size_t idx) const;
-      const std::string& operator()(const std::string& name) const;
+      const std::string& operator()(const std::string_view& name, const size_t idx) const;
+      const std::string& operator()(const std::string_view& name) const;
       const std::string& operator()(const char name, const size_t idx) const;
       const std::string& operator()(const char name) const;
+      // Typed values of the last parse, see parse_result::get
+      template <typename T>
+      T get(const std::string_view& name, const size_t idx) const;
+      template <typename T>
+      T get(const std::string_view& name) const;
+      template <typename T>
+      T get(const char name, const size_t idx) const;
+      template <typename T>
+      T get(const char name) const;
+      template <typename T>
+      std::vector<T> get_all(const std::string_view& name) const;
+      template <typename T>
+      std::vector<T> get_all(const char name) const;
 
       const entity_ptr& root() const;
 
     private:
-      bool parsed_{false};
-      
       std::vector<std::string> long_prefixes_{"--"};
       std::vector<std::string> short_prefixes_{"-"};
       std::vector<std::string> separators_{"="};
       std::vector<std::string> take_as_positionals_args_{"--"};
+      bool allow_abbreviations_{false};
 
       entity_ptr root_;
-
-      // Actual value holders
-      std::map<entity_ptr, std::vector<std::string>> values_;
-      std::vector<entity_ptr> positionals_;
-
-      static void vertical_name_check(const std::vector<std::string>& taken_long_names,
-                                      const std::vector<char>& taken_short_names,
-                                      const entity_ptr& e);
-      static void validate_entity(const entity_ptr& e);
-      void min_value_check(std::vector<actual_counts_mismatch::record>& acc, const entity_ptr& e) const;
-      
-      bool is_long_prefix(const std::string& s) const;
-      bool is_short_prefix(const std::string& s) const;
-
+      // Compiled scheme used by parse, dropped when the scheme is modified
+      mutable std::shared_ptr<const compiled_scheme> compiled_;
+      // Scheme the results of the last parse refer to, kept after compiled_ is dropped
+      std::shared_ptr<const compiled_scheme> parsed_;
+      // Results of the last parse
+      parse_result result_;
+      // Copies of the last parse values by compiled scheme node
+      std::vector<std::vector<std::string>> values_;
+
+      void store_values();
+
+      // Names of the ancestors are kept in scoped sets, added on the way down and removed on the way up
+      static void vertical_name_check(std::unordered_set<std::string_view>& taken_long,
+                                      std::array<bool, 256>& taken_short,
+                                      const entity* e);
+      static void validate_entity(const entity* e);
     };
 
     struct entity {
@@ -74,14 +200,8 @@ namespace optspp {
         VALUE
       };
       
-      enum class COLOR {
-        NONE,
-        BORDER,
-        VISITED,
-        BLOCKED
-      };
-
       entity(const KIND kind);
+      // Copies attributes, children are shared with other
       entity(const entity& other);
       void set_siblings_group(const SIBLINGS_GROUP group);
 
@@ -94,23 +214,31 @@ namespace optspp {
       void set_known_value(const std::vector<std::string>& vs);
       void set_known_value(::optspp::any);
 
+      // Add child to the group. A parentless child from the same arena is taken as is if may_adopt is set
+      // and nobody else holds it, otherwise its subtree is copied into this entity's arena. Returns false
+      // if child is already there
+      bool add_child(const entity_ptr& child, const SIBLINGS_GROUP group, const bool may_adopt);
+
       // Assign value definition to argument definition and argument definition to value definition; the children are xor-compatible
       friend std::shared_ptr<entity> optspp::operator<<(std::shared_ptr<entity> lhs, const std::shared_ptr<entity>& rhs);
+      friend std::shared_ptr<entity> optspp::operator<<(std::shared_ptr<entity> lhs, std::shared_ptr<entity>&& rhs);
       // Assign value definition to argument definition and argument definition to value definition; the children are or-compatible
       friend std::shared_ptr<entity> optspp::operator|(std::shared_ptr<entity> lhs, const std::shared_ptr<entity>& rhs);
+      friend std::shared_ptr<entity> optspp::operator|(std::shared_ptr<entity> lhs, std::shared_ptr<entity>&& rhs);
       // Assign argument definition to scheme definition; the children are or-compatible
       friend definition& optspp::operator<<(scheme::definition& lhs, const std::shared_ptr<entity>& rhs);  
+      friend definition& optspp::operator<<(scheme::definition& lhs, std::shared_ptr<entity>&& rhs);
       // Assign argument definition to scheme definition; the children are or-compatible
       friend definition& optspp::operator|(scheme::definition& lhs, const std::shared_ptr<entity>& rhs);
+      friend definition& optspp::operator|(scheme::definition& lhs, std::shared_ptr<entity>&& rhs);
 
       bool name_matches(const std::string& s) const;
       bool name_matches(const char& c) const;
-      bool value_matches(const std::string& s) const;
+      bool value_matches(const std::string_view& s) const;
       
       KIND kind() const;
       SIBLINGS_GROUP siblings_group() const;
-      COLOR color() const;
-      const std::vector<entity_ptr>& children() const;
+      const std::vector<entity*>& children() const;
 
       std::string all_names_to_string() const;
       const optional<std::vector<std::string>>& long_names() const;
@@ -126,11 +254,12 @@ namespace optspp {
       
       friend struct optspp::scheme::parser;
       friend struct scheme::definition;
+      friend struct scheme::arena;
+      friend struct scheme::compiled_scheme;
       
     private:
       KIND kind_{KIND::NONE};
       SIBLINGS_GROUP siblings_group_{SIBLINGS_GROUP::NONE};
-      COLOR color_{COLOR::NONE};
 
       // Attributes
       //   Argument's attributes
@@ -159,8 +288,261 @@ namespace optspp {
       // Allow to take any value
       optional<bool> any_value_;
 
-      // Children
-      std::vector<entity_ptr> pending_;
+      // Arena the entity is allocated in
+      arena* arena_{nullptr};
+      // Is a child of some entity, so can't be adopted by another one
+      bool has_parent_{false};
+      // Handle given out by arena::share, its use count tells if the entity is held elsewhere
+      std::weak_ptr<entity> handle_;
+      // Children, allocated in the same arena
+      std::vector<entity*> pending_;
+    };
+
+    // Block storage for scheme entities. Entities are destroyed all at once with the arena, which lives
+    // as long as any entity_ptr to one of its entities. Not synchronized: like the entities in it, an
+    // arena is modified by one thread at a time.
+    struct arena : std::enable_shared_from_this<arena> {
+      arena() = default;
+      arena(const arena&) = delete;
+      arena& operator=(const arena&) = delete;
+      ~arena();
+
+      // Makes an arena current for the factory functions on this thread while alive. Scopes nest.
+      struct scope {
+        scope(const std::shared_ptr<arena>& a);
+        // Allocate in the definition's arena, so that its entities are adopted rather than copied
+        scope(const definition& d);
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+        ~scope();
+      private:
+        std::shared_ptr<arena> previous_;
+      };
+
+      // Arena the factory functions allocate from on this thread: the one of the innermost scope, or else
+      // an arena shared by the thread's factory calls. The shared arena is replaced when it is full or
+      // no entity of it is alive, so long-lived entities keep at most shared_size entities allocated.
+      static std::shared_ptr<arena> current();
+
+      entity_ptr make(const entity::KIND kind);
+      // Deep copy of e with its children, allocated in this arena
+      entity* clone(const entity& e);
+      // Owning pointer to an entity of this arena. Entities have one handle at a time, so its use count
+      // is the number of entity_ptrs to the entity.
+      entity_ptr share(entity* e);
+      // Number of entities allocated
+      size_t size() const;
+
+      static constexpr size_t shared_size = 1024;
+
+    private:
+      using storage = typename std::aligned_storage<sizeof(entity), alignof(entity)>::type;
+      static constexpr size_t block_size = 64;
+
+      std::vector<std::unique_ptr<storage[]>> blocks_;
+      size_t size_{0};
+
+      entity* allocate(const entity& e);
+      // Arena of the innermost scope on this thread, null if none
+      static std::shared_ptr<arena>& scoped();
+    };
+
+    // Prefix tree over strings, used for completion. Keys view strings that must outlive the trie.
+    struct trie {
+      trie();
+      // Add entry under key, a key may have several entries
+      void insert(const std::string_view& key, const size_t entry);
+      // Call f(key, entries) for each key starting with prefix, in key order
+      template <typename F>
+      void for_each_prefixed(const std::string_view& prefix, F f) const;
+      // Entries of the only key starting with prefix, nullptr if there are none or several such keys.
+      // Takes time linear in the key length.
+      const std::vector<size_t>* find_unique(const std::string_view& prefix) const;
+
+    private:
+      struct node {
+        // Child nodes by next character, sorted by character
+        std::vector<std::pair<char, size_t>> children;
+        std::string_view key;
+        std::vector<size_t> entries;
+      };
+      std::vector<node> nodes_;
+    };
+
+    // Flattened, read-only scheme representation that can be parsed any number of times.
+    // Nodes are laid out breadth-first: children of a node occupy a contiguous index range
+    // and always have greater indices than their parent. Node 0 is the root.
+    struct compiled_scheme {
+      static constexpr size_t npos = std::numeric_limits<size_t>::max();
+      
+      struct node {
+        entity::KIND kind{entity::KIND::NONE};
+        SIBLINGS_GROUP siblings_group{SIBLINGS_GROUP::NONE};
+        size_t parent{npos};
+        size_t first_child{0};
+        size_t children_count{0};
+        bool is_positional{false};
+        bool is_any_value{false};
+        // True if the node has argument children, i.e. may be a parsing border
+        bool has_argument_children{false};
+        // Positional argument children, range in positional_children_
+        size_t first_positional{0};
+        size_t positionals_count{0};
+        // First any value child of an argument, npos if none
+        size_t any_value{npos};
+        // Known values table of an argument, npos if it has no known values
+        size_t known_values{npos};
+        // XOR group the node belongs to with its siblings of the same kind, npos if none
+        size_t xor_group{npos};
+        // Source entity, holds names and values
+        entity_ptr source;
+      };
+
+      compiled_scheme(const definition& d);
+      // Compile a tree that was validated elsewhere, using default prefixes and separators
+      compiled_scheme(const entity_ptr& root);
+
+      // Parse command line arguments. The scheme is not modified by parsing, so it may be parsed
+      // concurrently from several threads as long as each thread uses its own parse_context
+      // The result keeps its own copy of the arguments.
+      parse_result parse(const std::vector<std::string>& cmdl_args) const;
+      parse_result parse(const std::vector<std::string>& cmdl_args, parse_context& ctx) const;
+      parse_result parse(const int argc, char* argv[]) const;
+      // Zero-copy parse: tokens and result values view the arguments, which must outlive the result.
+      // argv[0] is skipped like in parse(argc, argv).
+      parse_result parse_view(const int argc, const char* const argv[]) const;
+      parse_result parse_view(const int argc, const char* const argv[], parse_context& ctx) const;
+      parse_result parse_view(const std::vector<std::string_view>& cmdl_args) const;
+      parse_result parse_view(const std::vector<std::string_view>& cmdl_args, parse_context& ctx) const;
+
+      // Parse arguments expanded from response files, the result keeps the files
+      parse_result parse(const std::shared_ptr<const response_files>& args) const;
+      parse_result parse(const std::shared_ptr<const response_files>& args, parse_context& ctx) const;
+
+      // Parse without throwing, failures are returned as parse_error
+      expected<parse_result, parse_error> try_parse(const std::vector<std::string>& cmdl_args) const;
+      expected<parse_result, parse_error> try_parse(const std::vector<std::string>& cmdl_args, parse_context& ctx) const;
+      expected<parse_result, parse_error> try_parse_view(const int argc, const char* const argv[]) const;
+      expected<parse_result, parse_error> try_parse_view(const std::vector<std::string_view>& cmdl_args) const;
+      expected<parse_result, parse_error> try_parse_view(const std::vector<std::string_view>& cmdl_args,
+                                                         parse_context& ctx) const;
+
+      // Result of one command line of a batch
+      using batch_result = expected<parse_result, parse_error>;
+      // Parse many command lines on up to threads threads (0 for hardware concurrency), each thread
+      // reusing its own parse_context. Results are in the order of the command lines.
+      std::vector<batch_result> parse_batch(const std::vector<std::vector<std::string>>& cmdl_args,
+                                            const size_t threads = 0) const;
+      // Zero-copy batch parse, the arguments must outlive the results
+      std::vector<batch_result> parse_batch_view(const std::vector<std::vector<std::string_view>>& cmdl_args,
+                                                 const size_t threads = 0) const;
+
+      const node& operator[](const size_t idx) const;
+      size_t size() const;
+      // Index of the node compiled from the entity, npos if the entity is not in the scheme
+      size_t index_of(const entity_ptr& e) const;
+      size_t index_of(const entity* e) const;
+
+      // Name resolution, names are shared by all argument nodes that have them
+      // Name id of long name, npos if no argument has the name
+      size_t name_id(const std::string_view& long_name) const;
+      // Name id of short name, npos if no argument has the name
+      size_t name_id(const char short_name) const;
+      // Name id of the long name that is the only one starting with abbreviation, npos if none. If the
+      // names starting with it belong to different arguments, returns npos and sets candidates to the
+      // argument nodes.
+      size_t abbreviated_name_id(const std::string_view& abbreviation, std::vector<size_t>& candidates) const;
+      // Argument nodes having the name
+      const std::vector<size_t>& named_nodes(const size_t name_id) const;
+      // True if no named argument having the name has implicit values, so the name must be followed by a value.
+      // The rest of a short option cluster after such a name is its value, e.g. -ofile.
+      bool requires_value(const size_t name_id) const;
+      // Number of distinct names
+      size_t names_count() const;
+      // Name ids of an argument node
+      const std::vector<size_t>& node_names(const size_t idx) const;
+
+      // Known value of an argument: the value node and the main synonym of its values
+      struct known_value {
+        size_t node;
+        std::string_view main;
+      };
+      // Value child of argument that lists s as a value, nullptr if none
+      const known_value* find_known_value(const size_t arg_idx, const std::string_view& s) const;
+
+      // Completion candidates for the last argument of a partial command line: options and values that
+      // may still be taken after the arguments before it, respecting XOR branches they have taken.
+      // Never throws on bad command lines.
+      std::vector<std::string> complete(const std::vector<std::string>& partial_argv) const;
+      std::vector<std::string> complete(const std::vector<std::string>& partial_argv, parse_context& ctx) const;
+
+      bool is_long_prefix(const std::string& s) const;
+      bool is_short_prefix(const std::string& s) const;
+
+      friend struct ::optspp::scheme::parser;
+      
+    private:
+      std::vector<std::string> long_prefixes_{"--"};
+      std::vector<std::string> short_prefixes_{"-"};
+      std::vector<std::string> separators_{"="};
+      std::vector<std::string> take_as_positionals_args_{"--"};
+      bool allow_abbreviations_{false};
+
+      std::vector<node> nodes_;
+      std::unordered_map<const entity*, size_t> index_;
+      // Positional argument children of nodes, contiguous per parent
+      std::vector<size_t> positional_children_;
+
+      // Long name to name id, the keys view names held by source entities
+      std::unordered_map<std::string_view, size_t> long_names_;
+      // Short name to name id, indexed by unsigned char
+      std::array<size_t, 256> short_names_;
+      // Argument nodes by name id
+      std::vector<std::vector<size_t>> named_nodes_;
+      std::vector<std::vector<size_t>> node_names_;
+      // By name id, see requires_value
+      std::vector<bool> requires_value_;
+      // Value synonym to value node per argument, the keys view values held by source entities
+      std::vector<std::unordered_map<std::string_view, known_value>> known_values_;
+      // XOR group as a bitmask over node indices, covering node bitset words [first_word, first_word + words_count)
+      struct xor_group {
+        size_t first_word;
+        size_t words_count;
+        // Offset of the mask words in xor_masks_
+        size_t offset;
+      };
+      std::vector<xor_group> xor_groups_;
+      std::vector<uint64_t> xor_masks_;
+      // Completion and abbreviation indices, built by the first completion or when abbreviations are
+      // allowed: long names to name ids, and value synonyms to value nodes per known_values_ entry
+      mutable std::once_flag completions_indexed_;
+      mutable trie long_names_trie_;
+      mutable std::vector<trie> values_tries_;
+      // Positional argument nodes with known values
+      mutable std::vector<size_t> positional_value_args_;
+
+      // Parse arguments copied to storage, the result keeps the storage
+      parse_result parse_storage(const std::shared_ptr<const std::vector<std::string>>& storage,
+                                 parse_context& ctx) const;
+      // Parse into rslt with a parser over args, without throwing
+      template <typename... Args>
+      expected<parse_result, parse_error> try_parse_into(parse_result&& rslt, parse_context& ctx, const Args&... args) const;
+      // Run parse_one(ctx, i) for i in [0, count) on worker threads pulling chunks of indices
+      template <typename ParseOne>
+      void run_batch(const size_t count, const size_t threads, ParseOne parse_one) const;
+      // Flatten the tree breadth-first and index names
+      void build(entity* root);
+      void add_node(entity* e, const size_t parent);
+      void add_name(const size_t name_id, const size_t idx);
+      void index_names();
+      void index_values();
+      void index_xor_groups();
+      void index_completions() const;
+      // True if the argument or value node may still be taken after the parse done with ctx
+      bool available(const parse_context& ctx, const size_t idx) const;
+      // Add values of the available argument nodes starting with prefix, each after head
+      void complete_values(std::vector<std::string>& rslt, const parse_context& ctx, const std::vector<size_t>& args,
+                           const std::string_view& head, const std::string_view& prefix) const;
     };
   }
 
@@ -212,3 +594,5 @@ namespace optspp {
   struct any {
   };
 }
+
+#include "exception.hpp"
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "../scheme.hpp"
+
+namespace optspp {
+  namespace scheme {
+    arena::~arena() {
+      for (size_t i = 0; i < size_; ++i) {
+        reinterpret_cast<entity*>(&blocks_[i / block_size][i % block_size])->~entity();
+      }
+    }
+
+    arena::scope::scope(const std::shared_ptr<arena>& a) :
+      previous_(std::move(scoped())) {
+      scoped() = a;
+    }
+
+    arena::scope::scope(const definition& d) :
+      scope(d.root()->arena_->shared_from_this()) {
+    }
+
+    arena::scope::~scope() {
+      scoped() = std::move(previous_);
+    }
+
+    std::shared_ptr<arena>& arena::scoped() {
+      static thread_local std::shared_ptr<arena> scoped_arena;
+      return scoped_arena;
+    }
+
+    std::shared_ptr<arena> arena::current() {
+      if (scoped()) return scoped();
+      static thread_local std::weak_ptr<arena> current_arena;
+      auto a = current_arena.lock();
+      if (!a || (a->size_ >= shared_size)) {
+        a = std::make_shared<arena>();
+        current_arena = a;
+      }
+      return a;
+    }
+
+    entity* arena::allocate(const entity& e) {
+      if (size_ % block_size == 0) blocks_.emplace_back(new storage[block_size]);
+      auto rslt = new (&blocks_.back()[size_ % block_size]) entity(e);
+      ++size_;
+      rslt->arena_ = this;
+      rslt->handle_.reset();
+      return rslt;
+    }
+
+    entity_ptr arena::make(const entity::KIND kind) {
+      return share(allocate(entity(kind)));
+    }
+
+    entity* arena::clone(const entity& e) {
+      auto rslt = allocate(e);
+      for (auto& c : rslt->pending_) c = clone(*c);
+      return rslt;
+    }
+
+    entity_ptr arena::share(entity* e) {
+      auto rslt = e->handle_.lock();
+      if (!rslt) {
+        // The handle keeps the arena alive. The deleter outlives the last handle while the entity keeps
+        // its weak handle, so it lets the arena go when called.
+        rslt = entity_ptr(e, [a = shared_from_this()] (entity*) mutable { a.reset(); });
+        e->handle_ = rslt;
+      }
+      return rslt;
+    }
+
+    size_t arena::size() const {
+      return size_;
+    }
+  }
+}
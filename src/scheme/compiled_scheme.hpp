@@ -0,0 +1,589 @@
+#pragma once
+
+#include "../scheme.hpp"
+
+namespace optspp {
+  namespace scheme {
+    compiled_scheme::compiled_scheme(const definition& d) :
+      long_prefixes_(d.long_prefixes_),
+      short_prefixes_(d.short_prefixes_),
+      separators_(d.separators_),
+      take_as_positionals_args_(d.take_as_positionals_args_),
+      allow_abbreviations_(d.allow_abbreviations_) {
+      d.validate();
+      build(d.root_.get());
+      if (allow_abbreviations_) std::call_once(completions_indexed_, [this] () { index_completions(); });
+    }
+
+    compiled_scheme::compiled_scheme(const entity_ptr& root) {
+      build(root.get());
+    }
+
+    void compiled_scheme::build(entity* root) {
+      add_node(root, npos);
+      // Values allowed implicitly are not part of the definition
+      std::shared_ptr<arena> implicit_values;
+      // Breadth-first flattening, nodes_ grows while we walk it
+      for (size_t i = 0; i < nodes_.size(); ++i) {
+        const entity* e = nodes_[i].source.get();
+        const size_t first_child = nodes_.size();
+        for (const auto& c : e->children()) add_node(c, i);
+        // Implicitly allow any value
+        if ((e->kind() == entity::KIND::ARGUMENT) &&
+            (std::find_if(e->children().begin(), e->children().end(), [] (const entity* v) {
+                return v->kind() == entity::KIND::VALUE;
+              }) == e->children().end())) {
+          if (!implicit_values) implicit_values = std::make_shared<arena>();
+          auto v = implicit_values->make(entity::KIND::VALUE);
+          v->set_known_value(any());
+          add_node(v.get(), i);
+        }
+        auto& n = nodes_[i];
+        n.first_child = first_child;
+        n.children_count = nodes_.size() - first_child;
+        n.first_positional = positional_children_.size();
+        for (size_t c = first_child; c < nodes_.size(); ++c) {
+          if (nodes_[c].kind == entity::KIND::ARGUMENT) {
+            n.has_argument_children = true;
+            if (nodes_[c].is_positional) positional_children_.push_back(c);
+          }
+        }
+        n.positionals_count = positional_children_.size() - n.first_positional;
+      }
+      index_names();
+      index_values();
+      index_xor_groups();
+    }
+
+    void compiled_scheme::index_completions() const {
+      for (const auto& n : long_names_) long_names_trie_.insert(n.first, n.second);
+      values_tries_.resize(known_values_.size());
+      for (size_t i = 0; i < known_values_.size(); ++i) {
+        for (const auto& v : known_values_[i]) values_tries_[i].insert(v.first, v.second.node);
+      }
+      for (size_t i = 0; i < nodes_.size(); ++i) {
+        if ((nodes_[i].kind == entity::KIND::ARGUMENT) && nodes_[i].is_positional &&
+            (nodes_[i].known_values != npos)) positional_value_args_.push_back(i);
+      }
+    }
+
+    void compiled_scheme::index_xor_groups() {
+      for (const auto& p : nodes_) {
+        for (const auto kind : {entity::KIND::ARGUMENT, entity::KIND::VALUE}) {
+          size_t first = npos;
+          size_t last = npos;
+          size_t count = 0;
+          for (size_t c = p.first_child; c < p.first_child + p.children_count; ++c) {
+            if ((nodes_[c].kind == kind) && (nodes_[c].siblings_group == SIBLINGS_GROUP::XOR)) {
+              if (first == npos) first = c;
+              last = c;
+              ++count;
+            }
+          }
+          // A lone XOR node has nobody to block
+          if (count < 2) continue;
+          xor_group g{first / 64, last / 64 - first / 64 + 1, xor_masks_.size()};
+          xor_masks_.resize(xor_masks_.size() + g.words_count, 0);
+          for (size_t c = first; c <= last; ++c) {
+            if ((nodes_[c].kind == kind) && (nodes_[c].siblings_group == SIBLINGS_GROUP::XOR)) {
+              xor_masks_[g.offset + c / 64 - g.first_word] |= uint64_t(1) << (c % 64);
+              nodes_[c].xor_group = xor_groups_.size();
+            }
+          }
+          xor_groups_.push_back(g);
+        }
+      }
+    }
+
+    void compiled_scheme::index_values() {
+      for (size_t i = 0; i < nodes_.size(); ++i) {
+        auto& a = nodes_[i];
+        if (a.kind != entity::KIND::ARGUMENT) continue;
+        for (size_t c = a.first_child; c < a.first_child + a.children_count; ++c) {
+          const auto& v = nodes_[c];
+          if (v.kind != entity::KIND::VALUE) continue;
+          if (v.is_any_value) {
+            if (a.any_value == npos) a.any_value = c;
+          } else if (v.source->known_values() && ((*v.source->known_values()).size() > 0)) {
+            if (a.known_values == npos) {
+              a.known_values = known_values_.size();
+              known_values_.emplace_back();
+            }
+            const auto& vs = *v.source->known_values();
+            // The first value child listing a synonym takes it
+            for (const auto& s : vs) known_values_[a.known_values].insert({s, {c, vs[0]}});
+          }
+        }
+      }
+    }
+
+    void compiled_scheme::index_names() {
+      short_names_.fill(npos);
+      node_names_.assign(nodes_.size(), std::vector<size_t>());
+      for (size_t i = 0; i < nodes_.size(); ++i) {
+        const auto& e = nodes_[i].source;
+        if (nodes_[i].kind != entity::KIND::ARGUMENT) continue;
+        if (e->long_names()) {
+          for (const auto& n : *e->long_names()) {
+            auto found = long_names_.find(n);
+            if (found == long_names_.end()) {
+              found = long_names_.insert({n, named_nodes_.size()}).first;
+              named_nodes_.emplace_back();
+            }
+            add_name(found->second, i);
+          }
+        }
+        if (e->short_names()) {
+          for (const auto& n : *e->short_names()) {
+            auto& id = short_names_[static_cast<unsigned char>(n)];
+            if (id == npos) {
+              id = named_nodes_.size();
+              named_nodes_.emplace_back();
+            }
+            add_name(id, i);
+          }
+        }
+      }
+      requires_value_.assign(named_nodes_.size(), false);
+      for (size_t id = 0; id < named_nodes_.size(); ++id) {
+        bool named = false;
+        bool implicit = false;
+        for (const auto& a : named_nodes_[id]) {
+          if (nodes_[a].is_positional) continue;
+          named = true;
+          if (nodes_[a].source->implicit_values()) implicit = true;
+        }
+        requires_value_[id] = named && !implicit;
+      }
+    }
+
+    void compiled_scheme::add_name(const size_t name_id, const size_t idx) {
+      auto& ns = named_nodes_[name_id];
+      if ((ns.size() == 0) || (ns.back() != idx)) {
+        ns.push_back(idx);
+        node_names_[idx].push_back(name_id);
+      }
+    }
+
+    void compiled_scheme::add_node(entity* e, const size_t parent) {
+      node n;
+      n.kind = e->kind();
+      n.siblings_group = e->siblings_group();
+      n.parent = parent;
+      n.is_positional = e->is_positional() && *e->is_positional();
+      n.is_any_value = e->is_any_value() && *e->is_any_value();
+      // Sources are only read, an alias of the arena does without a handle per node
+      n.source = entity_ptr(e->arena_->shared_from_this(), e);
+      index_.insert({e, nodes_.size()});
+      nodes_.push_back(n);
+    }
+
+    parse_result compiled_scheme::parse(const std::vector<std::string>& cmdl_args) const {
+      parse_context ctx;
+      return parse(cmdl_args, ctx);
+    }
+
+    parse_result compiled_scheme::parse(const std::vector<std::string>& cmdl_args, parse_context& ctx) const {
+      return parse_storage(std::make_shared<const std::vector<std::string>>(cmdl_args), ctx);
+    }
+
+    parse_result compiled_scheme::parse(const int argc, char* argv[]) const {
+      parse_context ctx;
+      if (argc > 1) {
+        return parse_storage(std::make_shared<const std::vector<std::string>>(argv + 1, argv + argc), ctx);
+      } else {
+        return parse_storage(std::make_shared<const std::vector<std::string>>(), ctx);
+      }
+    }
+
+    parse_result compiled_scheme::parse_storage(const std::shared_ptr<const std::vector<std::string>>& storage,
+                                                parse_context& ctx) const {
+      parse_result rslt;
+      rslt.storage_ = storage;
+      parser p(*this, ctx, rslt, *storage);
+      p.parse();
+      p.validate_results();
+      return rslt;
+    }
+
+    parse_result compiled_scheme::parse(const std::shared_ptr<const response_files>& args) const {
+      parse_context ctx;
+      return parse(args, ctx);
+    }
+
+    parse_result compiled_scheme::parse(const std::shared_ptr<const response_files>& args, parse_context& ctx) const {
+      parse_result rslt;
+      rslt.storage_ = args;
+      parser p(*this, ctx, rslt, args->args().size(), args->args().data());
+      p.parse();
+      p.validate_results();
+      return rslt;
+    }
+
+    parse_result compiled_scheme::parse_view(const int argc, const char* const argv[]) const {
+      parse_context ctx;
+      return parse_view(argc, argv, ctx);
+    }
+
+    parse_result compiled_scheme::parse_view(const int argc, const char* const argv[], parse_context& ctx) const {
+      parse_result rslt;
+      parser p(*this, ctx, rslt, argc > 1 ? argc - 1 : 0, argv + 1);
+      p.parse();
+      p.validate_results();
+      return rslt;
+    }
+
+    parse_result compiled_scheme::parse_view(const std::vector<std::string_view>& cmdl_args) const {
+      parse_context ctx;
+      return parse_view(cmdl_args, ctx);
+    }
+
+    parse_result compiled_scheme::parse_view(const std::vector<std::string_view>& cmdl_args, parse_context& ctx) const {
+      parse_result rslt;
+      parser p(*this, ctx, rslt, cmdl_args.size(), cmdl_args.data());
+      p.parse();
+      p.validate_results();
+      return rslt;
+    }
+
+    template <typename ParseOne>
+    void compiled_scheme::run_batch(const size_t count, const size_t threads, ParseOne parse_one) const {
+      size_t workers = threads > 0 ? threads : std::thread::hardware_concurrency();
+      if (workers == 0) workers = 1;
+      // Small chunks keep the load balanced when command lines differ in length,
+      // idle workers take the next chunk from whatever is left
+      const size_t chunk = std::max<size_t>(1, count / (workers * 8));
+      workers = std::min(workers, (count + chunk - 1) / chunk);
+      std::atomic<size_t> next{0};
+      auto work = [&next, count, chunk, &parse_one] () {
+        parse_context ctx;
+        for (size_t first = next.fetch_add(chunk); first < count; first = next.fetch_add(chunk)) {
+          const size_t last = std::min(first + chunk, count);
+          for (size_t i = first; i < last; ++i) parse_one(ctx, i);
+        }
+      };
+      std::vector<std::thread> pool;
+      for (size_t i = 1; i < workers; ++i) pool.emplace_back(work);
+      // The calling thread works too
+      if (workers > 0) work();
+      for (auto& t : pool) t.join();
+    }
+
+    std::vector<compiled_scheme::batch_result>
+    compiled_scheme::parse_batch(const std::vector<std::vector<std::string>>& cmdl_args, const size_t threads) const {
+      std::vector<batch_result> rslt(cmdl_args.size(), batch_result::failure(parse_error()));
+      run_batch(cmdl_args.size(), threads, [this, &cmdl_args, &rslt] (parse_context& ctx, const size_t i) {
+          rslt[i] = try_parse(cmdl_args[i], ctx);
+        });
+      return rslt;
+    }
+
+    std::vector<compiled_scheme::batch_result>
+    compiled_scheme::parse_batch_view(const std::vector<std::vector<std::string_view>>& cmdl_args, const size_t threads) const {
+      std::vector<batch_result> rslt(cmdl_args.size(), batch_result::failure(parse_error()));
+      run_batch(cmdl_args.size(), threads, [this, &cmdl_args, &rslt] (parse_context& ctx, const size_t i) {
+          rslt[i] = try_parse_view(cmdl_args[i], ctx);
+        });
+      return rslt;
+    }
+
+    template <typename... Args>
+    expected<parse_result, parse_error> compiled_scheme::try_parse_into(parse_result&& rslt, parse_context& ctx,
+                                                                        const Args&... args) const {
+      parser p(*this, ctx, rslt, args...);
+      if (!p.try_parse() || !p.try_validate_results()) {
+        auto e = p.error();
+        e.storage_ = rslt.storage_;
+        return expected<parse_result, parse_error>::failure(e);
+      }
+      return std::move(rslt);
+    }
+
+    expected<parse_result, parse_error> compiled_scheme::try_parse(const std::vector<std::string>& cmdl_args) const {
+      parse_context ctx;
+      return try_parse(cmdl_args, ctx);
+    }
+
+    expected<parse_result, parse_error> compiled_scheme::try_parse(const std::vector<std::string>& cmdl_args,
+                                                                   parse_context& ctx) const {
+      parse_result rslt;
+      auto storage = std::make_shared<const std::vector<std::string>>(cmdl_args);
+      rslt.storage_ = storage;
+      return try_parse_into(std::move(rslt), ctx, *storage);
+    }
+
+    expected<parse_result, parse_error> compiled_scheme::try_parse_view(const int argc, const char* const argv[]) const {
+      parse_context ctx;
+      return try_parse_into(parse_result(), ctx, static_cast<size_t>(argc > 1 ? argc - 1 : 0), argv + 1);
+    }
+
+    expected<parse_result, parse_error> compiled_scheme::try_parse_view(const std::vector<std::string_view>& cmdl_args) const {
+      parse_context ctx;
+      return try_parse_view(cmdl_args, ctx);
+    }
+
+    expected<parse_result, parse_error> compiled_scheme::try_parse_view(const std::vector<std::string_view>& cmdl_args,
+                                                                        parse_context& ctx) const {
+      return try_parse_into(parse_result(), ctx, cmdl_args.size(), cmdl_args.data());
+    }
+
+    auto compiled_scheme::operator[](const size_t idx) const -> const node& {
+      return nodes_[idx];
+    }
+
+    size_t compiled_scheme::size() const {
+      return nodes_.size();
+    }
+
+    size_t compiled_scheme::index_of(const entity_ptr& e) const {
+      return index_of(e.get());
+    }
+
+    size_t compiled_scheme::index_of(const entity* e) const {
+      auto found = index_.find(e);
+      if (found != index_.end()) return found->second;
+      return npos;
+    }
+
+    size_t compiled_scheme::name_id(const std::string_view& long_name) const {
+      auto found = long_names_.find(long_name);
+      if (found != long_names_.end()) return found->second;
+      return npos;
+    }
+
+    size_t compiled_scheme::name_id(const char short_name) const {
+      return short_names_[static_cast<unsigned char>(short_name)];
+    }
+
+    size_t compiled_scheme::abbreviated_name_id(const std::string_view& abbreviation,
+                                                std::vector<size_t>& candidates) const {
+      candidates.clear();
+      std::call_once(completions_indexed_, [this] () { index_completions(); });
+      auto is_named = [this] (const size_t id) {
+        return std::any_of(named_nodes_[id].begin(), named_nodes_[id].end(), [this] (const size_t a) {
+            return !nodes_[a].is_positional;
+          });
+      };
+      const auto unique = long_names_trie_.find_unique(abbreviation);
+      if (unique != nullptr) return is_named((*unique)[0]) ? (*unique)[0] : npos;
+      // Several names start with it, which is fine if they are synonyms of the same arguments
+      size_t rslt = npos;
+      bool ambiguous = false;
+      long_names_trie_.for_each_prefixed(abbreviation, [&] (const std::string_view&, const std::vector<size_t>& ids) {
+          const size_t id = ids[0];
+          if (!is_named(id)) return;
+          if (rslt == npos) {
+            rslt = id;
+          } else if (named_nodes_[id] != named_nodes_[rslt]) {
+            ambiguous = true;
+          }
+          for (const auto& a : named_nodes_[id]) {
+            if (!nodes_[a].is_positional) candidates.push_back(a);
+          }
+        });
+      if (!ambiguous) {
+        candidates.clear();
+        return rslt;
+      }
+      std::sort(candidates.begin(), candidates.end());
+      candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+      return npos;
+    }
+
+    bool compiled_scheme::requires_value(const size_t name_id) const {
+      return requires_value_[name_id];
+    }
+
+    const std::vector<size_t>& compiled_scheme::named_nodes(const size_t name_id) const {
+      return named_nodes_[name_id];
+    }
+
+    size_t compiled_scheme::names_count() const {
+      return named_nodes_.size();
+    }
+
+    const std::vector<size_t>& compiled_scheme::node_names(const size_t idx) const {
+      return node_names_[idx];
+    }
+
+    auto compiled_scheme::find_known_value(const size_t arg_idx, const std::string_view& s) const -> const known_value* {
+      const auto& a = nodes_[arg_idx];
+      if (a.known_values == npos) return nullptr;
+      const auto& vs = known_values_[a.known_values];
+      auto found = vs.find(s);
+      if (found != vs.end()) return &found->second;
+      return nullptr;
+    }
+
+    std::vector<std::string> compiled_scheme::complete(const std::vector<std::string>& partial_argv) const {
+      parse_context ctx;
+      return complete(partial_argv, ctx);
+    }
+
+    std::vector<std::string> compiled_scheme::complete(const std::vector<std::string>& partial_argv,
+                                                       parse_context& ctx) const {
+      std::call_once(completions_indexed_, [this] () { index_completions(); });
+      std::vector<std::string> rslt;
+      std::vector<std::string_view> before(partial_argv.begin(), partial_argv.end());
+      std::string_view word;
+      if (before.size() > 0) {
+        word = before.back();
+        before.pop_back();
+      }
+      bool terminated = false;
+      for (const auto& a : before) {
+        if (std::find(take_as_positionals_args_.begin(), take_as_positionals_args_.end(), a) !=
+            take_as_positionals_args_.end()) terminated = true;
+      }
+      auto starts_with = [] (const std::string_view& s, const std::string_view& prefix) {
+        return s.substr(0, prefix.size()) == prefix;
+      };
+      auto named_args = [this] (const size_t id) {
+        std::vector<size_t> args;
+        if (id != npos) {
+          for (const auto& a : named_nodes_[id]) {
+            if (!nodes_[a].is_positional) args.push_back(a);
+          }
+        }
+        return args;
+      };
+
+      // Option before the word without an attached value takes the word as its value, e.g. --output <word>
+      std::vector<size_t> value_of;
+      if (!terminated && (before.size() > 0)) {
+        const auto& last = before.back();
+        size_t id = npos;
+        bool prefixed = false;
+        for (const auto& lp : long_prefixes_) {
+          if (!prefixed && starts_with(last, lp)) {
+            prefixed = true;
+            const auto rest = last.substr(lp.size());
+            if (std::none_of(separators_.begin(), separators_.end(), [&rest] (const std::string& sep) {
+                  return rest.find(sep) != std::string_view::npos;
+                })) id = name_id(rest);
+          }
+        }
+        for (const auto& sp : short_prefixes_) {
+          if (!prefixed && starts_with(last, sp)) {
+            prefixed = true;
+            if (last.size() == sp.size() + 1) id = name_id(last[sp.size()]);
+          }
+        }
+        value_of = named_args(id);
+        // Its value is completed against the state before it
+        if (value_of.size() > 0) before.pop_back();
+      }
+
+      parse_result r;
+      parser p(*this, ctx, r, before.size(), before.data());
+      p.try_parse();
+
+      bool needs_value = false;
+      if (value_of.size() > 0) {
+        value_of.erase(std::remove_if(value_of.begin(), value_of.end(), [this, &ctx] (const size_t a) {
+              return !available(ctx, a);
+            }), value_of.end());
+        complete_values(rslt, ctx, value_of, std::string_view(), word);
+        // Without implicit values the word can only be the value
+        needs_value = (value_of.size() > 0) &&
+          std::none_of(value_of.begin(), value_of.end(), [this] (const size_t a) {
+              return bool(nodes_[a].source->implicit_values());
+            });
+      }
+
+      bool prefixed = false;
+      if (!terminated && !needs_value) {
+        auto add_long = [this, &ctx, &rslt] (const std::string& lp, const std::string_view& name_prefix) {
+          long_names_trie_.for_each_prefixed(name_prefix, [&] (const std::string_view& key, const std::vector<size_t>& ids) {
+              for (const auto& a : named_nodes_[ids[0]]) {
+                if (!nodes_[a].is_positional && available(ctx, a)) {
+                  rslt.emplace_back(lp).append(key);
+                  break;
+                }
+              }
+            });
+        };
+        for (const auto& lp : long_prefixes_) {
+          if (starts_with(word, lp)) {
+            prefixed = true;
+            const auto rest = word.substr(lp.size());
+            size_t sep_pos = std::string_view::npos;
+            size_t sep_size = 0;
+            for (const auto& sep : separators_) {
+              const auto pos = rest.find(sep);
+              if (pos < sep_pos) {
+                sep_pos = pos;
+                sep_size = sep.size();
+              }
+            }
+            if (sep_pos != std::string_view::npos) {
+              // --name=value
+              complete_values(rslt, ctx, named_args(name_id(rest.substr(0, sep_pos))),
+                              word.substr(0, lp.size() + sep_pos + sep_size), rest.substr(sep_pos + sep_size));
+            } else {
+              add_long(lp, rest);
+            }
+          } else if (starts_with(lp, word)) {
+            add_long(lp, std::string_view());
+          }
+        }
+        for (const auto& sp : short_prefixes_) {
+          const bool whole = starts_with(word, sp) && !prefixed;
+          if (whole) prefixed = true;
+          if ((whole && (word.size() <= sp.size() + 1)) || (!starts_with(word, sp) && starts_with(sp, word))) {
+            for (size_t c = 0; c < short_names_.size(); ++c) {
+              if ((short_names_[c] == npos) || ((word.size() > sp.size()) && (static_cast<unsigned char>(word[sp.size()]) != c)))
+                continue;
+              const auto args = named_args(short_names_[c]);
+              if (std::any_of(args.begin(), args.end(), [this, &ctx] (const size_t a) { return available(ctx, a); }))
+                rslt.push_back(sp + char(c));
+            }
+          }
+        }
+      }
+
+      // Known values of positional arguments
+      if (!needs_value && !prefixed) {
+        complete_values(rslt, ctx, positional_value_args_, std::string_view(), word);
+      }
+
+      // A single trie walk is in order already
+      if (!std::is_sorted(rslt.begin(), rslt.end())) std::sort(rslt.begin(), rslt.end());
+      rslt.erase(std::unique(rslt.begin(), rslt.end()), rslt.end());
+      return rslt;
+    }
+
+    bool compiled_scheme::available(const parse_context& ctx, const size_t idx) const {
+      if (ctx.color(idx) == parse_context::COLOR::BLOCKED) return false;
+      // Children of the root, or of a node taken by the parse
+      const size_t parent = nodes_[idx].parent;
+      return (parent == 0) || (ctx.color(parent) == parse_context::COLOR::BORDER) ||
+        (ctx.color(parent) == parse_context::COLOR::VISITED);
+    }
+
+    void compiled_scheme::complete_values(std::vector<std::string>& rslt,
+                                          const parse_context& ctx,
+                                          const std::vector<size_t>& args,
+                                          const std::string_view& head,
+                                          const std::string_view& prefix) const {
+      // Each argument walks only the trie of its own values
+      for (const auto& a : args) {
+        if ((nodes_[a].known_values == npos) || !available(ctx, a)) continue;
+        values_tries_[nodes_[a].known_values].for_each_prefixed(prefix, [&] (const std::string_view& key,
+                                                                             const std::vector<size_t>& values) {
+            if (std::any_of(values.begin(), values.end(), [&ctx] (const size_t v) {
+                  return ctx.color(v) != parse_context::COLOR::BLOCKED;
+                })) rslt.emplace_back(head).append(key);
+          });
+      }
+    }
+
+    bool compiled_scheme::is_long_prefix(const std::string& s) const {
+      return std::find(long_prefixes_.begin(), long_prefixes_.end(), s) != long_prefixes_.end();
+    }
+
+    bool compiled_scheme::is_short_prefix(const std::string& s) const {
+      return std::find(short_prefixes_.begin(), short_prefixes_.end(), s) != short_prefixes_.end();
+    }
+  }
+}
@@ -5,84 +5,117 @@
 namespace optspp {
   namespace scheme {
     definition::definition() {
-      root_ = std::make_shared<entity>(entity::KIND::NONE);
+      // Each definition keeps its entities in its own arena
+      root_ = std::make_shared<arena>()->make(entity::KIND::NONE);
     }
     
     void definition::parse(const std::vector<std::string>& cmdl_args) {
-      if (parsed_) return;
-      validate();
-      parser p(*this, cmdl_args);
-      p.parse();
-      validate_results();
+      finalize();
+      result_ = compiled_->parse(cmdl_args);
+      store_values();
     }
 
     void definition::parse(const int argc, char* argv[]) {
-      std::vector<std::string> args;
-      if (argc > 1) {
-        for (int i = 1; i < argc; ++i) args.push_back(std::string(argv[i]));
+      finalize();
+      // Typed getters read the result, so it keeps copies of the arguments
+      result_ = compiled_->parse(argc, argv);
+      store_values();
+    }
+
+    optional<parse_error> definition::try_parse(const std::vector<std::string>& cmdl_args) {
+      finalize();
+      auto r = compiled_->try_parse(cmdl_args);
+      if (!r) return r.error();
+      result_ = std::move(*r);
+      store_values();
+      return optional<parse_error>();
+    }
+
+    void definition::store_values() {
+      parsed_ = compiled_;
+      values_.resize(compiled_->size());
+      for (size_t i = 0; i < values_.size(); ++i) {
+        const auto& vs = result_.values(i);
+        values_[i].assign(vs.begin(), vs.end());
       }
-      parse(args);
     }
 
-    void definition::vertical_name_check(const std::vector<std::string>& taken_long_names,
-                                         const std::vector<char>& taken_short_names,
-                                         const entity_ptr& e) {
-      auto taken_long = taken_long_names;
-      auto taken_short = taken_short_names;
+    std::shared_ptr<const compiled_scheme> definition::compile() const {
+      return std::make_shared<compiled_scheme>(*this);
+    }
+
+    std::shared_ptr<const compiled_scheme> definition::finalize() const {
+      if (!compiled_) compiled_ = compile();
+      return compiled_;
+    }
+
+    void definition::allow_abbreviations(const bool allow) {
+      if (allow_abbreviations_ != allow) compiled_.reset();
+      allow_abbreviations_ = allow;
+    }
+
+    void definition::vertical_name_check(std::unordered_set<std::string_view>& taken_long,
+                                         std::array<bool, 256>& taken_short,
+                                         const entity* e) {
+      // Names this entity adds to the branch, a name may be listed more than once by the entity
+      std::vector<std::string_view> added_long;
+      std::vector<unsigned char> added_short;
       if (e->kind_ == entity::KIND::ARGUMENT) {
         if (e->long_names_) {
           for (const auto& n : *e->long_names_) {
-            if (std::find(taken_long.begin(), taken_long.end(), n) != taken_long.end())
-              throw scheme_error("Argument's long name should not be used by it's descendant");
+            if (taken_long.count(n) > 0)
+              OPTSPP_THROW(scheme_error("Argument's long name should not be used by it's descendant"));
+          }
+          for (const auto& n : *e->long_names_) {
+            if (taken_long.insert(n).second) added_long.push_back(n);
           }
-          std::copy((*e->long_names_).begin(), (*e->long_names_).end(), std::back_inserter(taken_long));
         }
         if (e->short_names_) {
           for (const auto& n : *e->short_names_) {
-            if (std::find(taken_short.begin(), taken_short.end(), n) != taken_short.end())
-              throw scheme_error("Argument's short name should not be used by it's descendant");
+            if (taken_short[static_cast<unsigned char>(n)])
+              OPTSPP_THROW(scheme_error("Argument's short name should not be used by it's descendant"));
+          }
+          for (const auto& n : *e->short_names_) {
+            auto& taken = taken_short[static_cast<unsigned char>(n)];
+            if (!taken) added_short.push_back(static_cast<unsigned char>(n));
+            taken = true;
           }
-          std::copy((*e->short_names_).begin(), (*e->short_names_).end(), std::back_inserter(taken_short));
         }
       }
       for (const auto& c : e->pending_) vertical_name_check(taken_long, taken_short, c);
+      for (const auto& n : added_long) taken_long.erase(n);
+      for (const auto& n : added_short) taken_short[n] = false;
     }
 
-    void definition::validate_entity(const entity_ptr& e) {
+    void definition::validate_entity(const entity* e) {
       if (e->kind_ == entity::KIND::ARGUMENT) {
         if (e->is_positional_ && *e->is_positional_) {
           if (e->short_names_)
-            throw scheme_error("Positional argument should not have short names");
+            OPTSPP_THROW(scheme_error("Positional argument should not have short names"));
           if (e->implicit_values_)
-            throw scheme_error("Positional argument should not implicit values");
+            OPTSPP_THROW(scheme_error("Positional argument should not implicit values"));
           if (e->any_value_ && *e->any_value_) {
             for (const auto& c : e->pending_) {
               if ((c->kind_ == entity::KIND::ARGUMENT) && e->is_positional_ && !*e->is_positional_)
-                throw scheme_error("Positional with any value should not have named child");
+                OPTSPP_THROW(scheme_error("Positional with any value should not have named child"));
             }
           }
         } else {
           bool short_undefined = !e->short_names_ || (e->short_names_ && (*e->short_names_).size() == 0);
           bool long_undefined = !e->long_names_ || (e->long_names_ && (*e->long_names_).size() == 0);
           if (short_undefined && long_undefined )
-            throw scheme_error("Named argument's both long and short names are empty");
+            OPTSPP_THROW(scheme_error("Named argument's both long and short names are empty"));
         }
         for (const auto& c : e->pending_) {
           if (c->kind_ != entity::KIND::VALUE) {
-            throw scheme_error("Argument entity shoud not have non-value child");
+            OPTSPP_THROW(scheme_error("Argument entity shoud not have non-value child"));
           }
         }
-        // Implicitly allow any value
-        if (std::find_if(e->pending_.begin(), e->pending_.end(), [] (const entity_ptr& v) {
-              return v->kind_ == entity::KIND::VALUE;
-            }) == e->pending_.end()) {
-          e->pending_.push_back(::optspp::value(any()));
-        }
       }
       if (e->kind_ == entity::KIND::VALUE) {
         for (const auto& c : e->pending_) {
           if (c->kind_ != entity::KIND::ARGUMENT)
-            throw scheme_error("Value entity should not have non-argument child");
+            OPTSPP_THROW(scheme_error("Value entity should not have non-argument child"));
         }
       }
       for (const auto& c : e->pending_) {
@@ -91,128 +124,86 @@ namespace optspp {
     }
     
     void definition::validate() const {
+      std::unordered_set<std::string_view> taken_long;
+      std::array<bool, 256> taken_short{};
       for (const auto& c : root_->pending_) {
         validate_entity(c);
-        vertical_name_check(std::vector<std::string>(), std::vector<char>(), c);
+        vertical_name_check(taken_long, taken_short, c);
       }
     }
 
-    void definition::min_value_check(std::vector<actual_counts_mismatch::record>& acc, const entity_ptr& e) const {
-      if (e->color_ != entity::COLOR::BLOCKED) {
-        if (e->min_count_) {
-          auto found = values_.find(e);
-          if (found == values_.end()) {
-            if (*e->min_count_ > 0) {
-              acc.push_back({e, 0});
-            }
-          } else {
-            if (found->first->min_count_ &&
-                (found->second.size() < *found->first->min_count_))
-              acc.push_back({e, found->second.size()});
-          }
-      
-        }
-        for (const auto& c : e->pending_) min_value_check(acc, c);
-      }
-    }
-
-    void definition::validate_results() const {
-      std::vector<actual_counts_mismatch::record> acc;
-      for (const auto& c : root_->pending_) {
-        min_value_check(acc, c);
-      }
-      for (const auto& p : values_) {
-        const auto& e = p.first;
-        const auto& vs = p.second;
-        if (e->max_count_ && (vs.size() > *e->max_count_)) {
-          acc.push_back({e, vs.size()});
-        }
-      }
-      if (acc.size() > 0) {
-        throw actual_counts_mismatch(acc);
-      }
-    }
-
-    bool definition::is_long_prefix(const std::string& s) const {
-      return std::find(long_prefixes_.begin(), long_prefixes_.end(), s) != long_prefixes_.end();
-    }
-
-    bool definition::is_short_prefix(const std::string& s) const {
-      return std::find(short_prefixes_.begin(), short_prefixes_.end(), s) != short_prefixes_.end();
-    }
-
     const entity_ptr& definition::root() const {
       return root_;
     }
 
-    const std::vector<std::string>& definition::operator[](const std::string& name) const {
-      for (const auto& p : values_) {
-        if (p.first->name_matches(name)) return p.second;
-      }
+    const std::vector<std::string>& definition::operator[](const std::string_view& name) const {
+      auto found = result_.find(name);
+      if (found != compiled_scheme::npos) return values_[found];
       static std::vector<std::string> empty;
       return empty;
     }
 
     const std::vector<std::string>& definition::operator[](const char name) const {
-      for (const auto& p : values_) {
-        if (p.first->name_matches(name)) return p.second;
-      }
+      auto found = result_.find(name);
+      if (found != compiled_scheme::npos) return values_[found];
       static std::vector<std::string> empty;
       return empty;
     }
 
-    const std::string& definition::operator()(const std::string& name, const size_t idx) const {
-      for (const auto& p : values_) {
-        if (p.first->name_matches(name)) {
-          if (p.second.size() < idx) {
-            return p.second[idx];
-          } else {
-            throw value_not_found(name, idx);
-          }
-        }
-      }
-      throw value_not_found("Argument '" + name + "' not found");
+    const std::string& definition::operator()(const std::string_view& name, const size_t idx) const {
+      auto found = result_.find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string(name)));
+      if (idx >= values_[found].size()) OPTSPP_THROW(value_not_found(std::string(name), idx));
+      return values_[found][idx];
     }
 
-    const std::string& definition::operator()(const std::string& name) const {
-      for (const auto& p : values_) {
-        if (p.first->name_matches(name)) {
-          if (p.second.size() > 0) {
-            return p.second[p.second.size() - 1];
-          } else {
-            throw value_not_found(name);
-          }
-        }
-      }
-      throw value_not_found("Argument '" + name + "' not found");
+    const std::string& definition::operator()(const std::string_view& name) const {
+      auto found = result_.find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string(name)));
+      return values_[found].back();
     }
 
     const std::string& definition::operator()(const char name, const size_t idx) const {
-      for (const auto& p : values_) {
-        if (p.first->name_matches(name)) {
-          if (p.second.size() < idx) {
-            return p.second[idx];
-          } else {
-            throw value_not_found(std::string() + name, idx);
-          }
-        }
-      }
-      throw value_not_found(std::string("Argument '") + name + "' not found");
+      auto found = result_.find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string() + name));
+      if (idx >= values_[found].size()) OPTSPP_THROW(value_not_found(std::string() + name, idx));
+      return values_[found][idx];
     }
 
     const std::string& definition::operator()(const char name) const {
-      for (const auto& p : values_) {
-        if (p.first->name_matches(name)) {
-          if (p.second.size() > 0) {
-            return p.second[p.second.size() - 1];
-          } else {
-            throw value_not_found(std::string() + name, 0);
-          }
-        }
-      }
-      throw value_not_found(std::string() + name);
+      auto found = result_.find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string() + name));
+      return values_[found].back();
     }
 
-    
+    template <typename T>
+    T definition::get(const std::string_view& name, const size_t idx) const {
+      return result_.get<T>(name, idx);
+    }
+
+    template <typename T>
+    T definition::get(const std::string_view& name) const {
+      return result_.get<T>(name);
+    }
+
+    template <typename T>
+    T definition::get(const char name, const size_t idx) const {
+      return result_.get<T>(name, idx);
+    }
+
+    template <typename T>
+    T definition::get(const char name) const {
+      return result_.get<T>(name);
+    }
+
+    template <typename T>
+    std::vector<T> definition::get_all(const std::string_view& name) const {
+      return result_.get_all<T>(name);
+    }
+
+    template <typename T>
+    std::vector<T> definition::get_all(const char name) const {
+      return result_.get_all<T>(name);
+    }
   }
 }
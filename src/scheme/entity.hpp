@@ -7,7 +7,6 @@ namespace optspp {
     entity::entity(const entity& other) :
       kind_(other.kind_),
       siblings_group_(other.siblings_group_),
-      color_(other.color_),
       description_(other.description_),
       long_names_(other.long_names_),
       short_names_(other.short_names_),
@@ -17,11 +16,9 @@ namespace optspp {
       known_values_(other.known_values_),
       implicit_values_(other.implicit_values_),
       default_values_(other.default_values_),
-      any_value_(other.any_value_) {
-      for (const auto& p : other.pending_) {
-        auto c = std::make_shared<entity>(*p);
-        pending_.push_back(c);
-      }
+      any_value_(other.any_value_),
+      has_parent_(other.has_parent_),
+      pending_(other.pending_) {
     }
     
     entity::entity(const KIND kind) :
@@ -70,7 +67,7 @@ namespace optspp {
             if (std::find(lhs.begin(), lhs.end(), *it) == lhs.end()) lhs.push_back(*it);
         }        
       } else {
-        throw scheme_error("Can't assign name to a non-argument entity");
+        OPTSPP_THROW(scheme_error("Can't assign name to a non-argument entity"));
       }
     }
 
@@ -121,6 +118,20 @@ namespace optspp {
       }
     }
 
+    bool entity::add_child(const entity_ptr& child, const SIBLINGS_GROUP group, const bool may_adopt) {
+      if (std::find(pending_.begin(), pending_.end(), child.get()) != pending_.end()) return false;
+      entity* c = child.get();
+      // A child held elsewhere, e.g. by a named variable the operand aliases, is copied: changing the
+      // variable later must not change this subtree
+      if (!may_adopt || (child.use_count() != 1) || c->has_parent_ || (c->arena_ != arena_) || (c == this)) {
+        c = arena_->clone(*c);
+      }
+      c->siblings_group_ = group;
+      c->has_parent_ = true;
+      pending_.push_back(c);
+      return true;
+    }
+
     bool entity::name_matches(const std::string& s) const {
       if (long_names_) {
         auto& long_names = *long_names_;
@@ -137,7 +148,7 @@ namespace optspp {
       return false;
     }
 
-    bool entity::value_matches(const std::string& s) const {
+    bool entity::value_matches(const std::string_view& s) const {
       if (kind_ == KIND::VALUE) {
         if (any_value_ && *any_value_) return true;
         if (known_values_) {
@@ -158,11 +169,7 @@ namespace optspp {
       return siblings_group_;
     }
 
-    auto entity::color() const -> COLOR {
-      return color_;
-    }
-
-    const std::vector<entity_ptr>& entity::children() const {
+    const std::vector<entity*>& entity::children() const {
       return pending_;
     }
     
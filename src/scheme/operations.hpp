@@ -17,7 +17,7 @@ namespace optspp {
   
   template <typename... Properties>
   scheme::entity_ptr positional(Properties&&... ps) {
-    scheme::entity_ptr e = std::make_shared<scheme::entity>(scheme::entity::KIND::ARGUMENT);
+    scheme::entity_ptr e = scheme::arena::current()->make(scheme::entity::KIND::ARGUMENT);
     e->set_positional();
     positional_(e, std::forward<Properties>(ps)...);
     return e;
@@ -37,20 +37,20 @@ namespace optspp {
   
   template <typename... Properties>
   scheme::entity_ptr named(Properties&&... ps) {
-    scheme::entity_ptr e = std::make_shared<scheme::entity>(scheme::entity::KIND::ARGUMENT);
+    scheme::entity_ptr e = scheme::arena::current()->make(scheme::entity::KIND::ARGUMENT);
     e->set_named();
     named_(e, std::forward<Properties>(ps)...);
     return e;
   }
 
   scheme::entity_ptr value(const std::string& val) {
-    scheme::entity_ptr e = std::make_shared<scheme::entity>(scheme::entity::KIND::VALUE);
+    scheme::entity_ptr e = scheme::arena::current()->make(scheme::entity::KIND::VALUE);
     e->set_known_value(std::vector<std::string>{val});
     return e;
   }
   
   scheme::entity_ptr value(const std::string& val, std::initializer_list<std::string> synonyms) {
-    scheme::entity_ptr e = std::make_shared<scheme::entity>(scheme::entity::KIND::VALUE);
+    scheme::entity_ptr e = scheme::arena::current()->make(scheme::entity::KIND::VALUE);
     std::vector<std::string> vs{val};
     for (const auto& s : synonyms) {
       vs.push_back(s);
@@ -60,24 +60,30 @@ namespace optspp {
   }
 
   scheme::entity_ptr value(any) {
-    scheme::entity_ptr e = std::make_shared<scheme::entity>(scheme::entity::KIND::VALUE);
+    scheme::entity_ptr e = scheme::arena::current()->make(scheme::entity::KIND::VALUE);
     e->set_known_value(any());
     return e;
   }
 
-  // TODO COPY by value to children???
+  // Children are copied from lvalue operands, rvalue operands are adopted when possible; see entity::add_child
   
   // Assign value definition to argument definition and argument definition to value definition; the children are xor-compatible
   std::shared_ptr<scheme::entity> operator<<(std::shared_ptr<scheme::entity> lhs, const std::shared_ptr<scheme::entity>& rhs) {
     if (((lhs->kind_ == scheme::entity::KIND::ARGUMENT) && (rhs->kind_ == scheme::entity::KIND::VALUE)) ||
         ((rhs->kind_ == scheme::entity::KIND::ARGUMENT) && (lhs->kind_ == scheme::entity::KIND::VALUE))) {
-      if (std::find(lhs->pending_.begin(), lhs->pending_.end(), rhs) == lhs->pending_.end()) {
-        auto e = std::make_shared<scheme::entity>(*rhs);
-        e->siblings_group_ = scheme::SIBLINGS_GROUP::XOR;
-        lhs->pending_.push_back(e);
-      }
+      lhs->add_child(rhs, scheme::SIBLINGS_GROUP::XOR, false);
     } else {
-      throw scheme_error("Scheme entity types are incompatible for combination");
+      OPTSPP_THROW(scheme_error("Scheme entity types are incompatible for combination"));
+    }
+    return lhs;
+  }
+
+  std::shared_ptr<scheme::entity> operator<<(std::shared_ptr<scheme::entity> lhs, std::shared_ptr<scheme::entity>&& rhs) {
+    if (((lhs->kind_ == scheme::entity::KIND::ARGUMENT) && (rhs->kind_ == scheme::entity::KIND::VALUE)) ||
+        ((rhs->kind_ == scheme::entity::KIND::ARGUMENT) && (lhs->kind_ == scheme::entity::KIND::VALUE))) {
+      lhs->add_child(rhs, scheme::SIBLINGS_GROUP::XOR, true);
+    } else {
+      OPTSPP_THROW(scheme_error("Scheme entity types are incompatible for combination"));
     }
     return lhs;
   }
@@ -86,15 +92,23 @@ namespace optspp {
   std::shared_ptr<scheme::entity> operator|(std::shared_ptr<scheme::entity> lhs, const std::shared_ptr<scheme::entity>& rhs) {
     if (((lhs->kind_ == scheme::entity::KIND::ARGUMENT) && (rhs->kind_ == scheme::entity::KIND::VALUE)) ||
         ((rhs->kind_ == scheme::entity::KIND::ARGUMENT) && (lhs->kind_ == scheme::entity::KIND::VALUE))) {
-      if (std::find(lhs->pending_.begin(), lhs->pending_.end(), rhs) == lhs->pending_.end()) {
-        auto e = std::make_shared<scheme::entity>(*rhs);
-        e->siblings_group_ = scheme::SIBLINGS_GROUP::OR;
-        lhs->pending_.push_back(e);
-      }
+      lhs->add_child(rhs, scheme::SIBLINGS_GROUP::OR, false);
+    } else {
+      OPTSPP_THROW(scheme_error("Scheme entity types are incompatible for combination: " +
+                                      std::to_string((int)lhs->kind_) + " and " +
+                                      std::to_string((int)rhs->kind_)));
+    }
+    return lhs;
+  }
+
+  std::shared_ptr<scheme::entity> operator|(std::shared_ptr<scheme::entity> lhs, std::shared_ptr<scheme::entity>&& rhs) {
+    if (((lhs->kind_ == scheme::entity::KIND::ARGUMENT) && (rhs->kind_ == scheme::entity::KIND::VALUE)) ||
+        ((rhs->kind_ == scheme::entity::KIND::ARGUMENT) && (lhs->kind_ == scheme::entity::KIND::VALUE))) {
+      lhs->add_child(rhs, scheme::SIBLINGS_GROUP::OR, true);
     } else {
-      throw scheme_error("Scheme entity types are incompatible for combination: " +
-                               std::to_string((int)lhs->kind_) + " and " +
-                               std::to_string((int)rhs->kind_));
+      OPTSPP_THROW(scheme_error("Scheme entity types are incompatible for combination: " +
+                                      std::to_string((int)lhs->kind_) + " and " +
+                                      std::to_string((int)rhs->kind_)));
     }
     return lhs;
   }
@@ -103,14 +117,20 @@ namespace optspp {
   // Assign argument definition to scheme definition; the children are or-compatible
   scheme::definition& operator<<(scheme::definition& lhs, const std::shared_ptr<scheme::entity>& rhs) {
     if (rhs->kind_ == scheme::entity::KIND::ARGUMENT) {
-      if (std::find(lhs.root_->pending_.begin(), lhs.root_->pending_.end(), rhs) == lhs.root_->pending_.end()) {
-        auto e = std::make_shared<scheme::entity>(*rhs);
-        e->siblings_group_ = scheme::SIBLINGS_GROUP::XOR;
-        lhs.root_->pending_.push_back(e);
-      }
+      if (lhs.root_->add_child(rhs, scheme::SIBLINGS_GROUP::XOR, false)) lhs.compiled_.reset();
+    } else {
+      OPTSPP_THROW(scheme_error("Scheme entity type are incompatible for setting as scheme root element: " +
+                                      std::to_string((int)rhs->kind_)));
+    }
+    return lhs;
+  }
+
+  scheme::definition& operator<<(scheme::definition& lhs, std::shared_ptr<scheme::entity>&& rhs) {
+    if (rhs->kind_ == scheme::entity::KIND::ARGUMENT) {
+      if (lhs.root_->add_child(rhs, scheme::SIBLINGS_GROUP::XOR, true)) lhs.compiled_.reset();
     } else {
-      throw scheme_error("Scheme entity type are incompatible for setting as scheme root element: " +
-                               std::to_string((int)rhs->kind_));
+      OPTSPP_THROW(scheme_error("Scheme entity type are incompatible for setting as scheme root element: " +
+                                      std::to_string((int)rhs->kind_)));
     }
     return lhs;
   }
@@ -118,14 +138,20 @@ namespace optspp {
   // Assign argument definition to scheme definition; the children are or-compatible
   scheme::definition& operator|(scheme::definition& lhs, const std::shared_ptr<scheme::entity>& rhs) {
     if (rhs->kind_ == scheme::entity::KIND::ARGUMENT) {
-      if (std::find(lhs.root_->pending_.begin(), lhs.root_->pending_.end(), rhs) == lhs.root_->pending_.end()) {
-        auto e = std::make_shared<scheme::entity>(*rhs);
-        e->siblings_group_ = scheme::SIBLINGS_GROUP::OR;
-        lhs.root_->pending_.push_back(e);
-      }
+      if (lhs.root_->add_child(rhs, scheme::SIBLINGS_GROUP::OR, false)) lhs.compiled_.reset();
+    } else {
+      OPTSPP_THROW(scheme_error("Scheme entity type are incompatible for setting as scheme root element: " +
+                                      std::to_string((int)rhs->kind_)));
+    }
+    return lhs;
+  }
+
+  scheme::definition& operator|(scheme::definition& lhs, std::shared_ptr<scheme::entity>&& rhs) {
+    if (rhs->kind_ == scheme::entity::KIND::ARGUMENT) {
+      if (lhs.root_->add_child(rhs, scheme::SIBLINGS_GROUP::OR, true)) lhs.compiled_.reset();
     } else {
-      throw scheme_error("Scheme entity type are incompatible for setting as scheme root element: " +
-                               std::to_string((int)rhs->kind_));
+      OPTSPP_THROW(scheme_error("Scheme entity type are incompatible for setting as scheme root element: " +
+                                      std::to_string((int)rhs->kind_)));
     }
     return lhs;
   }
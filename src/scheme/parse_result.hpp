@@ -0,0 +1,188 @@
+#pragma once
+
+#include "../scheme.hpp"
+
+namespace optspp {
+  namespace scheme {
+    size_t parse_result::slot(const size_t name_id) const {
+      if (name_id < slots_.size()) return slots_[name_id];
+      return compiled_scheme::npos;
+    }
+
+    size_t parse_result::find(const std::string_view& name) const {
+      if (scheme_ == nullptr) return compiled_scheme::npos;
+      return slot(scheme_->name_id(name));
+    }
+
+    size_t parse_result::find(const char name) const {
+      if (scheme_ == nullptr) return compiled_scheme::npos;
+      return slot(scheme_->name_id(name));
+    }
+
+    const std::vector<std::string_view>& parse_result::operator[](const std::string_view& name) const {
+      auto found = find(name);
+      if (found != compiled_scheme::npos) return values_[found];
+      static std::vector<std::string_view> empty;
+      return empty;
+    }
+
+    const std::vector<std::string_view>& parse_result::operator[](const char name) const {
+      auto found = find(name);
+      if (found != compiled_scheme::npos) return values_[found];
+      static std::vector<std::string_view> empty;
+      return empty;
+    }
+
+    std::string_view parse_result::operator()(const std::string_view& name, const size_t idx) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string(name)));
+      if (idx >= values_[found].size()) OPTSPP_THROW(value_not_found(std::string(name), idx));
+      return values_[found][idx];
+    }
+
+    std::string_view parse_result::operator()(const std::string_view& name) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string(name)));
+      return values_[found].back();
+    }
+
+    std::string_view parse_result::operator()(const char name, const size_t idx) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string() + name));
+      if (idx >= values_[found].size()) OPTSPP_THROW(value_not_found(std::string() + name, idx));
+      return values_[found][idx];
+    }
+
+    std::string_view parse_result::operator()(const char name) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string() + name));
+      return values_[found].back();
+    }
+
+    const std::vector<std::string_view>& parse_result::values(const size_t idx) const {
+      return values_[idx];
+    }
+
+    const std::vector<size_t>& parse_result::positionals() const {
+      return positionals_;
+    }
+
+    const std::vector<parse_result::position>& parse_result::positions(const size_t idx) const {
+      return positions_[idx];
+    }
+
+    parse_result::conversion_cache::conversion_cache(const conversion_cache& other) :
+      nodes_(std::atomic_load(&other.nodes_)) {
+    }
+
+    auto parse_result::conversion_cache::operator=(const conversion_cache& other) -> conversion_cache& {
+      std::atomic_store(&nodes_, std::atomic_load(&other.nodes_));
+      return *this;
+    }
+
+    auto parse_result::conversion_cache::get(const size_t nodes_count) const -> std::shared_ptr<std::vector<node_conversions>> {
+      auto rslt = std::atomic_load(&nodes_);
+      if (!rslt) {
+        auto created = std::make_shared<std::vector<node_conversions>>(nodes_count);
+        // Another thread may have created it meanwhile, then rslt is set to its cache
+        if (std::atomic_compare_exchange_strong(&nodes_, &rslt, created)) rslt = created;
+      }
+      return rslt;
+    }
+
+    void parse_result::conversion_cache::reset() {
+      std::atomic_store(&nodes_, std::shared_ptr<std::vector<node_conversions>>());
+    }
+
+    template <typename T>
+    T parse_result::convert(const size_t node, const size_t idx, const std::string_view& name) const {
+      const auto& s = values_[node][idx];
+      if constexpr (std::is_same<T, std::string_view>::value) {
+        return s;
+      } else if constexpr (std::is_same<T, std::string>::value) {
+        return std::string(s);
+      } else {
+        static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value &&
+                      !std::is_same<T, char>::value && !std::is_same<T, signed char>::value &&
+                      !std::is_same<T, unsigned char>::value,
+                      "Values can be converted to string types, or to arithmetic types except bool and char");
+        auto convert_one = [&] () {
+          T v{};
+          const auto end = s.data() + s.size();
+          const auto [ptr, ec] = std::from_chars(s.data(), end, v);
+          if ((ec != std::errc()) || (ptr != end) || (s.size() == 0)) {
+            const auto& p = positions_[node][idx];
+            OPTSPP_THROW(value_conversion_failed(std::string(name), std::string(s), p.pos_arg_num, p.pos_in_arg));
+          }
+          return v;
+        };
+        const auto cache = converted_.get(values_.size());
+        auto& cs = (*cache)[node];
+        std::call_once(cs.allocated, [&] () {
+            cs.size = values_[node].size();
+            cs.values.reset(new conversion[cs.size]);
+          });
+        // Only values present at the first conversion are cached
+        if (idx >= cs.size) return convert_one();
+        auto& c = cs.values[idx];
+        // A failed conversion leaves the flag unset and throws
+        std::call_once(c.converted, [&] () { c.value = convert_one(); });
+        // Conversions to other types than the first one are not cached
+        if (!std::holds_alternative<T>(c.value)) return convert_one();
+        return std::get<T>(c.value);
+      }
+    }
+
+    template <typename T>
+    std::vector<T> parse_result::convert_all(const size_t node, const std::string_view& name) const {
+      std::vector<T> rslt;
+      rslt.reserve(values_[node].size());
+      for (size_t i = 0; i < values_[node].size(); ++i) rslt.push_back(convert<T>(node, i, name));
+      return rslt;
+    }
+
+    template <typename T>
+    T parse_result::get(const std::string_view& name, const size_t idx) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string(name)));
+      if (idx >= values_[found].size()) OPTSPP_THROW(value_not_found(std::string(name), idx));
+      return convert<T>(found, idx, name);
+    }
+
+    template <typename T>
+    T parse_result::get(const std::string_view& name) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string(name)));
+      return convert<T>(found, values_[found].size() - 1, name);
+    }
+
+    template <typename T>
+    T parse_result::get(const char name, const size_t idx) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string() + name));
+      if (idx >= values_[found].size()) OPTSPP_THROW(value_not_found(std::string() + name, idx));
+      return convert<T>(found, idx, std::string_view(&name, 1));
+    }
+
+    template <typename T>
+    T parse_result::get(const char name) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) OPTSPP_THROW(value_not_found(std::string() + name));
+      return convert<T>(found, values_[found].size() - 1, std::string_view(&name, 1));
+    }
+
+    template <typename T>
+    std::vector<T> parse_result::get_all(const std::string_view& name) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) return std::vector<T>();
+      return convert_all<T>(found, name);
+    }
+
+    template <typename T>
+    std::vector<T> parse_result::get_all(const char name) const {
+      auto found = find(name);
+      if (found == compiled_scheme::npos) return std::vector<T>();
+      return convert_all<T>(found, std::string_view(&name, 1));
+    }
+  }
+}
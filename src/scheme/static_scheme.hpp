@@ -0,0 +1,301 @@
+#pragma once
+
+#include "../static_scheme.hpp"
+
+namespace optspp {
+  namespace static_scheme {
+    template <typename T>
+    constexpr void list<T>::push_back(const T& v) {
+      if (size == max_list_size)
+        OPTSPP_THROW(scheme_error("Too many names or values in a static scheme node, raise OPTSPP_STATIC_LIST_SIZE"));
+      items[size] = v;
+      ++size;
+    }
+
+    template <typename T>
+    constexpr bool list<T>::contains(const T& v) const {
+      for (size_t i = 0; i < size; ++i) {
+        if (items[i] == v) return true;
+      }
+      return false;
+    }
+
+    template <typename T>
+    constexpr const T* list<T>::begin() const {
+      return items;
+    }
+
+    template <typename T>
+    constexpr const T* list<T>::end() const {
+      return items + size;
+    }
+
+    constexpr min_count::min_count(const size_t _count) :
+      count(_count) {
+    }
+
+    constexpr max_count::max_count(const size_t _count) :
+      count(_count) {
+    }
+
+    template <typename... Values>
+    constexpr implicit_values::implicit_values(const Values&... _values) {
+      static_assert(sizeof...(Values) <= max_list_size, "Too many implicit values, raise OPTSPP_STATIC_LIST_SIZE");
+      (values.push_back(std::string_view(_values)), ...);
+    }
+
+    template <typename... Values>
+    constexpr default_values::default_values(const Values&... _values) {
+      static_assert(sizeof...(Values) <= max_list_size, "Too many default values, raise OPTSPP_STATIC_LIST_SIZE");
+      (values.push_back(std::string_view(_values)), ...);
+    }
+
+    constexpr description::description(const std::string_view& _text) :
+      text(_text) {
+    }
+
+    constexpr long_name name(const std::string_view& name_str, std::initializer_list<std::string_view> synonyms) {
+      long_name rslt;
+      rslt.names.push_back(name_str);
+      for (const auto& s : synonyms) {
+        if (!rslt.names.contains(s)) rslt.names.push_back(s);
+      }
+      return rslt;
+    }
+
+    constexpr short_name name(const char name_char, std::initializer_list<char> synonyms) {
+      short_name rslt;
+      rslt.names.push_back(name_char);
+      for (const auto& s : synonyms) {
+        if (!rslt.names.contains(s)) rslt.names.push_back(s);
+      }
+      return rslt;
+    }
+
+    constexpr void node::apply_property(const static_scheme::long_name& p) {
+      for (const auto& n : p.names) {
+        if (!long_names.contains(n)) long_names.push_back(n);
+      }
+    }
+
+    constexpr void node::apply_property(const static_scheme::short_name& p) {
+      for (const auto& n : p.names) {
+        if (!short_names.contains(n)) short_names.push_back(n);
+      }
+    }
+
+    constexpr void node::apply_property(const static_scheme::min_count& p) {
+      has_min_count = true;
+      this->min_count = p.count;
+    }
+
+    constexpr void node::apply_property(const static_scheme::max_count& p) {
+      has_max_count = true;
+      this->max_count = p.count;
+    }
+
+    constexpr void node::apply_property(const static_scheme::implicit_values& p) {
+      for (const auto& v : p.values) implicit_values.push_back(v);
+    }
+
+    constexpr void node::apply_property(const static_scheme::default_values& p) {
+      for (const auto& v : p.values) default_values.push_back(v);
+    }
+
+    constexpr void node::apply_property(const static_scheme::description& p) {
+      description = p.text;
+    }
+
+    template <typename... Properties>
+    constexpr entity<1, scheme::entity::KIND::ARGUMENT> positional(const Properties&... ps) {
+      static_assert(!(std::is_same<Properties, short_name>::value || ...),
+                    "Positional argument should not have short names");
+      static_assert(!(std::is_same<Properties, implicit_values>::value || ...),
+                    "Positional argument should not implicit values");
+      entity<1, scheme::entity::KIND::ARGUMENT> rslt;
+      auto& n = rslt.nodes[0];
+      n.kind = scheme::entity::KIND::ARGUMENT;
+      n.is_positional = true;
+      (n.apply_property(ps), ...);
+      return rslt;
+    }
+
+    template <typename... Properties>
+    constexpr entity<1, scheme::entity::KIND::ARGUMENT> named(const Properties&... ps) {
+      static_assert((std::is_same<Properties, long_name>::value || ...) ||
+                    (std::is_same<Properties, short_name>::value || ...),
+                    "Named argument's both long and short names are empty");
+      entity<1, scheme::entity::KIND::ARGUMENT> rslt;
+      auto& n = rslt.nodes[0];
+      n.kind = scheme::entity::KIND::ARGUMENT;
+      (n.apply_property(ps), ...);
+      return rslt;
+    }
+
+    constexpr entity<1, scheme::entity::KIND::VALUE> value(const std::string_view& val,
+                                                           std::initializer_list<std::string_view> synonyms) {
+      entity<1, scheme::entity::KIND::VALUE> rslt;
+      auto& n = rslt.nodes[0];
+      n.kind = scheme::entity::KIND::VALUE;
+      n.known_values.push_back(val);
+      for (const auto& s : synonyms) n.known_values.push_back(s);
+      return rslt;
+    }
+
+    constexpr entity<1, scheme::entity::KIND::VALUE> value(any) {
+      entity<1, scheme::entity::KIND::VALUE> rslt;
+      auto& n = rslt.nodes[0];
+      n.kind = scheme::entity::KIND::VALUE;
+      n.is_any_value = true;
+      return rslt;
+    }
+
+    // Append rhs table as the last child of lhs table's first node
+    template <size_t N, size_t M>
+    constexpr void append(std::array<node, N + M>& dst,
+                          const std::array<node, N>& lhs,
+                          const std::array<node, M>& rhs,
+                          const scheme::SIBLINGS_GROUP group) {
+      for (size_t i = 0; i < N; ++i) dst[i] = lhs[i];
+      for (size_t i = 0; i < M; ++i) {
+        dst[N + i] = rhs[i];
+        if (i == 0) {
+          dst[N].parent = 0;
+          dst[N].siblings_group = group;
+        } else {
+          dst[N + i].parent += N;
+        }
+      }
+      dst[0].size += M;
+    }
+
+    // A name may not be reused by the argument's descendants
+    template <size_t N>
+    constexpr void vertical_name_check(const std::array<node, N>& nodes, const size_t first) {
+      for (size_t i = first; i < first + nodes[first].size; ++i) {
+        for (size_t a = nodes[i].parent; a != scheme::compiled_scheme::npos; a = nodes[a].parent) {
+          for (const auto& n : nodes[i].long_names) {
+            if (nodes[a].long_names.contains(n))
+              OPTSPP_THROW(scheme_error("Argument's long name should not be used by it's descendant"));
+          }
+          for (const auto& n : nodes[i].short_names) {
+            if (nodes[a].short_names.contains(n))
+              OPTSPP_THROW(scheme_error("Argument's short name should not be used by it's descendant"));
+          }
+        }
+      }
+    }
+
+    template <size_t N, scheme::entity::KIND K, size_t M, scheme::entity::KIND L>
+    constexpr entity<N + M, K> operator<<(const entity<N, K>& lhs, const entity<M, L>& rhs) {
+      static_assert(K != L, "Scheme entity types are incompatible for combination");
+      entity<N + M, K> rslt;
+      append<N, M>(rslt.nodes, lhs.nodes, rhs.nodes, scheme::SIBLINGS_GROUP::XOR);
+      return rslt;
+    }
+
+    template <size_t N, scheme::entity::KIND K, size_t M, scheme::entity::KIND L>
+    constexpr entity<N + M, K> operator|(const entity<N, K>& lhs, const entity<M, L>& rhs) {
+      static_assert(K != L, "Scheme entity types are incompatible for combination");
+      entity<N + M, K> rslt;
+      append<N, M>(rslt.nodes, lhs.nodes, rhs.nodes, scheme::SIBLINGS_GROUP::OR);
+      return rslt;
+    }
+
+    template <size_t N, size_t M, scheme::entity::KIND L>
+    constexpr definition<N + M> operator<<(const definition<N>& lhs, const entity<M, L>& rhs) {
+      static_assert(L == scheme::entity::KIND::ARGUMENT,
+                    "Scheme entity type are incompatible for setting as scheme root element");
+      definition<N + M> rslt;
+      append<N, M>(rslt.nodes, lhs.nodes, rhs.nodes, scheme::SIBLINGS_GROUP::XOR);
+      vertical_name_check(rslt.nodes, N);
+      return rslt;
+    }
+
+    template <size_t N, size_t M, scheme::entity::KIND L>
+    constexpr definition<N + M> operator|(const definition<N>& lhs, const entity<M, L>& rhs) {
+      static_assert(L == scheme::entity::KIND::ARGUMENT,
+                    "Scheme entity type are incompatible for setting as scheme root element");
+      definition<N + M> rslt;
+      append<N, M>(rslt.nodes, lhs.nodes, rhs.nodes, scheme::SIBLINGS_GROUP::OR);
+      vertical_name_check(rslt.nodes, N);
+      return rslt;
+    }
+
+    template <size_t N>
+    constexpr definition<N>::definition() {
+      nodes[0].size = N;
+    }
+
+    template <size_t N>
+    constexpr std::array<size_t, N> definition<N>::compiled_indices() const {
+      // Same breadth-first walk as compiled_scheme, which adds an any value to arguments without values
+      std::array<size_t, N> rslt{};
+      std::array<size_t, N> queue{};
+      size_t head = 0;
+      size_t tail = 0;
+      size_t count = 1;
+      rslt[0] = 0;
+      queue[tail++] = 0;
+      while (head < tail) {
+        const size_t p = queue[head++];
+        for (size_t c = p + 1; c < p + nodes[p].size; c += nodes[c].size) {
+          rslt[c] = count++;
+          queue[tail++] = c;
+        }
+        if ((nodes[p].kind == scheme::entity::KIND::ARGUMENT) && (nodes[p].size == 1)) ++count;
+      }
+      return rslt;
+    }
+
+    template <size_t N>
+    constexpr size_t definition<N>::index_of(const std::string_view& long_name) const {
+      const auto indices = compiled_indices();
+      size_t rslt = scheme::compiled_scheme::npos;
+      for (size_t i = 0; i < N; ++i) {
+        if (nodes[i].long_names.contains(long_name) && (indices[i] < rslt)) rslt = indices[i];
+      }
+      return rslt;
+    }
+
+    template <size_t N>
+    constexpr size_t definition<N>::index_of(const char short_name) const {
+      const auto indices = compiled_indices();
+      size_t rslt = scheme::compiled_scheme::npos;
+      for (size_t i = 0; i < N; ++i) {
+        if (nodes[i].short_names.contains(short_name) && (indices[i] < rslt)) rslt = indices[i];
+      }
+      return rslt;
+    }
+
+    template <size_t N>
+    std::shared_ptr<const scheme::compiled_scheme> definition<N>::compile() const {
+      auto a = std::make_shared<scheme::arena>();
+      std::vector<scheme::entity_ptr> es;
+      es.reserve(N);
+      es.push_back(a->make(scheme::entity::KIND::NONE));
+      for (size_t i = 1; i < N; ++i) {
+        const auto& n = nodes[i];
+        auto e = a->make(n.kind);
+        if (n.kind == scheme::entity::KIND::ARGUMENT) {
+          if (n.is_positional) e->set_positional(); else e->set_named();
+          for (const auto& s : n.long_names) e->apply_property(::optspp::name(std::string(s)));
+          for (const auto& c : n.short_names) e->apply_property(::optspp::name(c));
+          for (const auto& v : n.implicit_values) e->apply_property(::optspp::implicit_values(std::string(v)));
+          for (const auto& v : n.default_values) e->apply_property(::optspp::default_values(std::string(v)));
+        } else if (n.is_any_value) {
+          e->set_known_value(any());
+        } else {
+          e->set_known_value(std::vector<std::string>(n.known_values.begin(), n.known_values.end()));
+        }
+        if (n.has_min_count) e->apply_property(::optspp::min_count(n.min_count));
+        if (n.has_max_count) e->apply_property(::optspp::max_count(n.max_count));
+        if (n.description.size() > 0) e->apply_property(::optspp::description(std::string(n.description)));
+        // Parents precede children in preorder
+        es[n.parent]->add_child(e, n.siblings_group, true);
+        es.push_back(e);
+      }
+      return std::make_shared<const scheme::compiled_scheme>(es[0]);
+    }
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "../scheme.hpp"
+
+namespace optspp {
+  namespace scheme {
+    trie::trie() :
+      nodes_(1) {
+    }
+
+    void trie::insert(const std::string_view& key, const size_t entry) {
+      size_t idx = 0;
+      for (const auto c : key) {
+        auto& cs = nodes_[idx].children;
+        auto found = std::lower_bound(cs.begin(), cs.end(), c, [] (const std::pair<char, size_t>& a, const char b) {
+            return a.first < b;
+          });
+        if ((found != cs.end()) && (found->first == c)) {
+          idx = found->second;
+        } else {
+          const size_t child = nodes_.size();
+          cs.insert(found, {c, child});
+          nodes_.emplace_back();
+          idx = child;
+        }
+      }
+      auto& n = nodes_[idx];
+      n.key = key;
+      n.entries.push_back(entry);
+    }
+
+    const std::vector<size_t>* trie::find_unique(const std::string_view& prefix) const {
+      size_t idx = 0;
+      for (const auto c : prefix) {
+        const auto& cs = nodes_[idx].children;
+        auto found = std::lower_bound(cs.begin(), cs.end(), c, [] (const std::pair<char, size_t>& a, const char b) {
+            return a.first < b;
+          });
+        if ((found == cs.end()) || (found->first != c)) return nullptr;
+        idx = found->second;
+      }
+      // Every leaf ends a key, so the key is unique while the path does not branch
+      while (true) {
+        const auto& n = nodes_[idx];
+        if (n.entries.size() > 0) return n.children.size() == 0 ? &n.entries : nullptr;
+        if (n.children.size() != 1) return nullptr;
+        idx = n.children[0].second;
+      }
+    }
+
+    template <typename F>
+    void trie::for_each_prefixed(const std::string_view& prefix, F f) const {
+      size_t idx = 0;
+      for (const auto c : prefix) {
+        const auto& cs = nodes_[idx].children;
+        auto found = std::lower_bound(cs.begin(), cs.end(), c, [] (const std::pair<char, size_t>& a, const char b) {
+            return a.first < b;
+          });
+        if ((found == cs.end()) || (found->first != c)) return;
+        idx = found->second;
+      }
+      // Preorder walk of the subtree visits keys in order
+      std::vector<size_t> stack{idx};
+      while (stack.size() > 0) {
+        const auto& n = nodes_[stack.back()];
+        stack.pop_back();
+        if (n.entries.size() > 0) f(n.key, n.entries);
+        for (auto c = n.children.rbegin(); c != n.children.rend(); ++c) stack.push_back(c->second);
+      }
+    }
+  }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <initializer_list>
+#include <string_view>
+#include <type_traits>
+
+#include "scheme.hpp"
+
+// Capacity of the name and value lists of a static scheme node: long names, short names, known values
+// with their synonyms, implicit and default values. Define before including optspp to raise it.
+#ifndef OPTSPP_STATIC_LIST_SIZE
+#define OPTSPP_STATIC_LIST_SIZE 8
+#endif
+
+namespace optspp {
+  // Scheme built at compile time. Mirrors the runtime builders: named(name(...), max_count(...)) << value(...).
+  // Mistakes expressible in types fail static_asserts, the rest (duplicate names along a branch) fail
+  // constant evaluation, so define static schemes as constexpr.
+  namespace static_scheme {
+    // Capacity of name synonyms and value lists of a node, see OPTSPP_STATIC_LIST_SIZE
+    constexpr size_t max_list_size = OPTSPP_STATIC_LIST_SIZE;
+
+    template <typename T>
+    struct list {
+      constexpr void push_back(const T& v);
+      constexpr bool contains(const T& v) const;
+      constexpr const T* begin() const;
+      constexpr const T* end() const;
+
+      T items[max_list_size]{};
+      size_t size{0};
+    };
+
+    // Properties
+    struct long_name {
+      list<std::string_view> names;
+    };
+
+    struct short_name {
+      list<char> names;
+    };
+
+    struct min_count {
+      constexpr min_count(const size_t _count);
+
+      size_t count;
+    };
+
+    struct max_count {
+      constexpr max_count(const size_t _count);
+
+      size_t count;
+    };
+
+    struct implicit_values {
+      template <typename... Values>
+      constexpr implicit_values(const Values&... _values);
+
+      list<std::string_view> values;
+    };
+
+    struct default_values {
+      template <typename... Values>
+      constexpr default_values(const Values&... _values);
+
+      list<std::string_view> values;
+    };
+
+    struct description {
+      constexpr description(const std::string_view& _text);
+
+      std::string_view text;
+    };
+
+    // Long name, e.g. name("force", {"f0rce"}), or short name, e.g. name('f', {'F'})
+    constexpr long_name name(const std::string_view& name_str, std::initializer_list<std::string_view> synonyms = {});
+    constexpr short_name name(const char name_char, std::initializer_list<char> synonyms = {});
+
+    // Scheme element in a flat table
+    struct node {
+      scheme::entity::KIND kind{scheme::entity::KIND::NONE};
+      scheme::SIBLINGS_GROUP siblings_group{scheme::SIBLINGS_GROUP::NONE};
+      // Index of the parent in the table, npos for the table's first node
+      size_t parent{scheme::compiled_scheme::npos};
+      // Number of nodes in the subtree, including this one
+      size_t size{1};
+      bool is_positional{false};
+      bool is_any_value{false};
+      list<std::string_view> long_names;
+      list<char> short_names;
+      list<std::string_view> known_values;
+      list<std::string_view> implicit_values;
+      list<std::string_view> default_values;
+      bool has_min_count{false};
+      size_t min_count{0};
+      bool has_max_count{false};
+      size_t max_count{0};
+      std::string_view description;
+
+      constexpr void apply_property(const static_scheme::long_name& p);
+      constexpr void apply_property(const static_scheme::short_name& p);
+      constexpr void apply_property(const static_scheme::min_count& p);
+      constexpr void apply_property(const static_scheme::max_count& p);
+      constexpr void apply_property(const static_scheme::implicit_values& p);
+      constexpr void apply_property(const static_scheme::default_values& p);
+      constexpr void apply_property(const static_scheme::description& p);
+    };
+
+    // Subtree of N nodes in preorder, the subtree's root is the first node
+    template <size_t N, scheme::entity::KIND Kind>
+    struct entity {
+      std::array<node, N> nodes{};
+    };
+
+    // Whole scheme of N nodes in preorder, the first node is the root
+    template <size_t N = 1>
+    struct definition {
+      constexpr definition();
+
+      // Index of the compiled scheme node of the first argument with the name, npos if none
+      constexpr size_t index_of(const std::string_view& long_name) const;
+      constexpr size_t index_of(const char short_name) const;
+      // Compiled scheme node index by table index, as laid out by compiled_scheme
+      constexpr std::array<size_t, N> compiled_indices() const;
+
+      // Build the runtime scheme: entities and compiled_scheme indices are built on each call, only
+      // validation is skipped
+      std::shared_ptr<const scheme::compiled_scheme> compile() const;
+
+      std::array<node, N> nodes{};
+    };
+
+    template <typename... Properties>
+    constexpr entity<1, scheme::entity::KIND::ARGUMENT> positional(const Properties&... ps);
+    template <typename... Properties>
+    constexpr entity<1, scheme::entity::KIND::ARGUMENT> named(const Properties&... ps);
+    constexpr entity<1, scheme::entity::KIND::VALUE> value(const std::string_view& val,
+                                                           std::initializer_list<std::string_view> synonyms = {});
+    constexpr entity<1, scheme::entity::KIND::VALUE> value(any);
+
+    // Assign value definition to argument definition and argument definition to value definition; the children are xor-compatible
+    template <size_t N, scheme::entity::KIND K, size_t M, scheme::entity::KIND L>
+    constexpr entity<N + M, K> operator<<(const entity<N, K>& lhs, const entity<M, L>& rhs);
+    // Assign value definition to argument definition and argument definition to value definition; the children are or-compatible
+    template <size_t N, scheme::entity::KIND K, size_t M, scheme::entity::KIND L>
+    constexpr entity<N + M, K> operator|(const entity<N, K>& lhs, const entity<M, L>& rhs);
+    // Assign argument definition to scheme definition; the children are xor-compatible
+    template <size_t N, size_t M, scheme::entity::KIND L>
+    constexpr definition<N + M> operator<<(const definition<N>& lhs, const entity<M, L>& rhs);
+    // Assign argument definition to scheme definition; the children are or-compatible
+    template <size_t N, size_t M, scheme::entity::KIND L>
+    constexpr definition<N + M> operator|(const definition<N>& lhs, const entity<M, L>& rhs);
+  }
+}
@@ -1,7 +1,11 @@
 #include <catch.hpp>
 #include <optspp/optspp>
 
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <map>
+#include <thread>
 
 SCENARIO("Test optional") {
   using namespace optspp;
@@ -94,30 +98,35 @@ SCENARIO("XOR scheme without 'any' values and positional args") {
     REQUIRE((*val_l2_2->known_values())[0] == "Val_L2_2");
     
     THEN("Command line: --Arg_L1_1 Val_L2_1 --Arg_L3_1 Val_L4_2") {
-      scheme::parser p(args, {"--Arg_L1_1", "Val_L2_1",  "--Arg_L3_1", "Val_L4_2"});
+      auto cs = args.compile();
+      scheme::parse_context ctx;
+      scheme::parse_result r;
+      // Tokens view the arguments, keep them alive
+      const std::vector<std::string> input{"--Arg_L1_1", "Val_L2_1",  "--Arg_L3_1", "Val_L4_2"};
+      scheme::parser p(*cs, ctx, r, input);
       p.initialize_pass();
       auto parent = p.find_border_entity();
-      REQUIRE(parent == args.root());
+      REQUIRE(parent == cs->index_of(args.root()));
       REQUIRE(p.consume_argument(parent));
-      //REQUIRE(arg_l1_1->color() == scheme::entity::COLOR::VISITED);
-      REQUIRE(arg_l1_2->color() == scheme::entity::COLOR::BLOCKED);
-      REQUIRE(val_l2_1->color() == scheme::entity::COLOR::BORDER);
-      REQUIRE(val_l2_2->color() == scheme::entity::COLOR::BLOCKED);
+      //REQUIRE(p.color(arg_l1_1) == scheme::parse_context::COLOR::VISITED);
+      REQUIRE(p.color(arg_l1_2) == scheme::parse_context::COLOR::BLOCKED);
+      REQUIRE(p.color(val_l2_1) == scheme::parse_context::COLOR::BORDER);
+      REQUIRE(p.color(val_l2_2) == scheme::parse_context::COLOR::BLOCKED);
       parent = p.find_border_entity();
-      REQUIRE(parent == val_l2_1);
+      REQUIRE(parent == cs->index_of(val_l2_1));
       REQUIRE(p.consume_argument(parent));
-      // REQUIRE(arg_l3_1->color() == scheme::entity::COLOR::VISITED);
-      REQUIRE(arg_l3_2->color() == scheme::entity::COLOR::BLOCKED);
-      REQUIRE(val_l4_1->color() == scheme::entity::COLOR::BLOCKED);
-      REQUIRE(val_l4_2->color() == scheme::entity::COLOR::BORDER);
-      REQUIRE(p.find_border_entity() == nullptr);
+      // REQUIRE(p.color(arg_l3_1) == scheme::parse_context::COLOR::VISITED);
+      REQUIRE(p.color(arg_l3_2) == scheme::parse_context::COLOR::BLOCKED);
+      REQUIRE(p.color(val_l4_1) == scheme::parse_context::COLOR::BLOCKED);
+      REQUIRE(p.color(val_l4_2) == scheme::parse_context::COLOR::BORDER);
+      REQUIRE(p.find_border_entity() == scheme::compiled_scheme::npos);
       THEN("Check results") {
-        REQUIRE(args["Arg_L1_1"].size() == 1);
-        REQUIRE(args["Arg_L1_1"][0] == "Val_L2_1");
-        REQUIRE(args["Arg_L3_1"].size() == 1);
-        REQUIRE(args["Arg_L3_1"][0] == "Val_L4_2");
-        REQUIRE(args["Arg_L3_2"].size() == 0);
-        REQUIRE(args["Arg_L1_2"].size() == 0);
+        REQUIRE(r["Arg_L1_1"].size() == 1);
+        REQUIRE(r["Arg_L1_1"][0] == "Val_L2_1");
+        REQUIRE(r["Arg_L3_1"].size() == 1);
+        REQUIRE(r["Arg_L3_1"][0] == "Val_L4_2");
+        REQUIRE(r["Arg_L3_2"].size() == 0);
+        REQUIRE(r["Arg_L1_2"].size() == 0);
       }
     }
   }            
@@ -180,72 +189,75 @@ SCENARIO("XOR/OR scheme with 'any' values and positional args") {
 
     std::vector<std::string> input{"--Arg_L1_1", "Val_1_L2_1",  "--Arg_L3_1", "Val_3_L4_2", "--Arg_L3_1", "Val_3_L4_1", "--Arg_L1_2", "Val_2_L2_2", "pos_val1" };
     THEN("Step by step") {
-      scheme::parser p(args, input);
+      auto cs = args.compile();
+      scheme::parse_context ctx;
+      scheme::parse_result r;
+      scheme::parser p(*cs, ctx, r, input);
       // Cycle 1
       p.initialize_pass();
       auto parent = p.find_border_entity();
-      REQUIRE(parent == args.root());
+      REQUIRE(parent == cs->index_of(args.root()));
       REQUIRE(p.consume_argument(parent));
-      //REQUIRE(arg_l1_1->color() == scheme::entity::COLOR::VISITED);
-      REQUIRE(arg_l1_2->color() == scheme::entity::COLOR::NONE);
-      REQUIRE(val_1_l2_1->color() == scheme::entity::COLOR::BORDER);
-      REQUIRE(val_1_l2_2->color() == scheme::entity::COLOR::BLOCKED);
+      //REQUIRE(p.color(arg_l1_1) == scheme::parse_context::COLOR::VISITED);
+      REQUIRE(p.color(arg_l1_2) == scheme::parse_context::COLOR::NONE);
+      REQUIRE(p.color(val_1_l2_1) == scheme::parse_context::COLOR::BORDER);
+      REQUIRE(p.color(val_1_l2_2) == scheme::parse_context::COLOR::BLOCKED);
       parent = p.find_border_entity();
-      REQUIRE(parent == val_1_l2_1);
+      REQUIRE(parent == cs->index_of(val_1_l2_1));
       REQUIRE(p.consume_argument(parent));
-      REQUIRE(arg_l3_1->color() == scheme::entity::COLOR::BORDER);
-      REQUIRE(val_3_l4_2->color() == scheme::entity::COLOR::BORDER);
+      REQUIRE(p.color(arg_l3_1) == scheme::parse_context::COLOR::BORDER);
+      REQUIRE(p.color(val_3_l4_2) == scheme::parse_context::COLOR::BORDER);
       parent = p.find_border_entity();
-      REQUIRE(parent == nullptr);
+      REQUIRE(parent == scheme::compiled_scheme::npos);
 
       // Cycle 2
       p.initialize_pass();
       parent = p.find_border_entity();
-      REQUIRE(parent == args.root());
+      REQUIRE(parent == cs->index_of(args.root()));
       REQUIRE(p.consume_argument(parent));
-      //REQUIRE(arg_l1_2->color() == scheme::entity::COLOR::VISITED);
-      REQUIRE(val_2_l2_2->color() == scheme::entity::COLOR::BORDER);
+      //REQUIRE(p.color(arg_l1_2) == scheme::parse_context::COLOR::VISITED);
+      REQUIRE(p.color(val_2_l2_2) == scheme::parse_context::COLOR::BORDER);
       parent = p.find_border_entity();
-      REQUIRE(parent == val_1_l2_1);
+      REQUIRE(parent == cs->index_of(val_1_l2_1));
       REQUIRE(p.consume_argument(parent));
-      REQUIRE(arg_l3_1->color() == scheme::entity::COLOR::BORDER);
-      REQUIRE(val_3_l4_1->color() == scheme::entity::COLOR::BORDER);
+      REQUIRE(p.color(arg_l3_1) == scheme::parse_context::COLOR::BORDER);
+      REQUIRE(p.color(val_3_l4_1) == scheme::parse_context::COLOR::BORDER);
       parent = p.find_border_entity();
-      REQUIRE(parent == nullptr);
+      REQUIRE(parent == scheme::compiled_scheme::npos);
 
       // Cycle 3
       p.initialize_pass();
       parent = p.find_border_entity();
-      REQUIRE(parent == args.root());
+      REQUIRE(parent == cs->index_of(args.root()));
       REQUIRE(p.consume_argument(parent));
-      //REQUIRE(positional->color() == scheme::entity::COLOR::VISITED);
-      REQUIRE(positional_val1->color() == scheme::entity::COLOR::BORDER);
-      REQUIRE(positional_val2->color() == scheme::entity::COLOR::BLOCKED);
+      //REQUIRE(p.color(positional) == scheme::parse_context::COLOR::VISITED);
+      REQUIRE(p.color(positional_val1) == scheme::parse_context::COLOR::BORDER);
+      REQUIRE(p.color(positional_val2) == scheme::parse_context::COLOR::BLOCKED);
       parent = p.find_border_entity();
-      REQUIRE(parent == val_1_l2_1);
+      REQUIRE(parent == cs->index_of(val_1_l2_1));
       REQUIRE(!p.consume_argument(parent));
 
       // Cycle 4
       p.initialize_pass();
       parent = p.find_border_entity();
-      REQUIRE(parent == args.root());
+      REQUIRE(parent == cs->index_of(args.root()));
       REQUIRE(!p.consume_argument(parent));
       parent = p.find_border_entity();
-      REQUIRE(parent == val_1_l2_1);
+      REQUIRE(parent == cs->index_of(val_1_l2_1));
       REQUIRE(!p.consume_argument(parent));
       parent = p.find_border_entity();
-      REQUIRE(parent == nullptr);
+      REQUIRE(parent == scheme::compiled_scheme::npos);
 
       THEN("Check resulting arg values") {
-        REQUIRE(args["Arg_L1_1"].size() == 1);
-        REQUIRE(args["Arg_L1_1"][0] == "Val_1_L2_1");
-        REQUIRE(args["Arg_L3_1"].size() == 2);
-        REQUIRE(args["Arg_L3_1"][0] == "Val_3_L4_2");
-        REQUIRE(args["Arg_L3_1"][1] == "Val_3_L4_1");
-        REQUIRE(args["Arg_L1_2"].size() == 1);
-        REQUIRE(args["Arg_L1_2"][0] == "Val_2_L2_2");
-        REQUIRE(args["positional"].size() == 1);
-        REQUIRE(args["positional"][0] == "pos_val1");
+        REQUIRE(r["Arg_L1_1"].size() == 1);
+        REQUIRE(r["Arg_L1_1"][0] == "Val_1_L2_1");
+        REQUIRE(r["Arg_L3_1"].size() == 2);
+        REQUIRE(r["Arg_L3_1"][0] == "Val_3_L4_2");
+        REQUIRE(r["Arg_L3_1"][1] == "Val_3_L4_1");
+        REQUIRE(r["Arg_L1_2"].size() == 1);
+        REQUIRE(r["Arg_L1_2"][0] == "Val_2_L2_2");
+        REQUIRE(r["positional"].size() == 1);
+        REQUIRE(r["positional"][0] == "pos_val1");
       }
     }
     THEN("High-level") {
@@ -443,3 +455,1264 @@ SCENARIO("rm example") {
     }
   }
 }
+
+SCENARIO("Compiled scheme is parsed multiple times") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("force"),
+             name('f'),
+             implicit_values("true"),
+             max_count(1))
+       << value("true", {"on", "yes"})
+       << value("false", {"off", "no"}))
+    | (positional(name("filename"),
+                  min_count(1))
+       << (value(any())));
+  auto cs = arguments.compile();
+  REQUIRE((*cs)[0].source == arguments.root());
+
+  WHEN("Parsing the compiled scheme repeatedly") {
+    for (int i = 0; i < 3; ++i) {
+      auto r = cs->parse(std::vector<std::string>{"-f", "file" + std::to_string(i)});
+      REQUIRE(r["force"].size() == 1);
+      REQUIRE(r["force"][0] == "true");
+      REQUIRE(r["filename"].size() == 1);
+      REQUIRE(r["filename"][0] == "file" + std::to_string(i));
+    }
+    auto r = cs->parse(std::vector<std::string>{"--force", "off", "a", "b"});
+    REQUIRE(r("force") == "false");
+    REQUIRE(r("filename", 1) == "b");
+    REQUIRE(r.positionals().size() == 2);
+    REQUIRE_THROWS_AS(r("filename", 2), value_not_found);
+  }
+
+  WHEN("Parsing the definition repeatedly") {
+    arguments.parse(std::vector<std::string>{"-f", "file1"});
+    REQUIRE(arguments["force"][0] == "true");
+    arguments.parse(std::vector<std::string>{"file2"});
+    REQUIRE(arguments["force"].size() == 0);
+    REQUIRE(arguments["filename"][0] == "file2");
+  }
+}
+
+SCENARIO("Border worklist opens nested branches within a pass") {
+  using namespace optspp;
+  const size_t depth = 50;
+  scheme::entity_ptr level = named(name("level" + std::to_string(depth - 1))) << value("on");
+  for (size_t i = depth - 1; i > 0; --i) {
+    level = named(name("level" + std::to_string(i - 1))) << (value("on") | level);
+  }
+  scheme::definition arguments;
+  arguments << level;
+  auto cs = arguments.compile();
+
+  WHEN("Nested options are given deepest first") {
+    std::vector<std::string> args;
+    for (size_t i = depth; i > 0; --i) {
+      args.push_back("--level" + std::to_string(i - 1));
+      args.push_back("on");
+    }
+    scheme::parse_context ctx;
+    scheme::parse_result r;
+    scheme::parser p(*cs, ctx, r, args);
+    p.initialize_pass();
+    REQUIRE(p.pass_tree());
+    THEN("The whole chain is consumed in one pass") {
+      for (size_t i = 0; i < depth; ++i) {
+        REQUIRE(r("level" + std::to_string(i)) == "on");
+      }
+      REQUIRE(p.find_border_entity() == scheme::compiled_scheme::npos);
+    }
+  }
+
+  WHEN("A branch is not opened") {
+    REQUIRE_THROWS_AS(cs->parse(std::vector<std::string>{"--level1", "on"}), unparsed_tokens);
+  }
+}
+
+SCENARIO("Long command lines") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("include"), name('I')) << value(any()))
+    | (positional(name("file")) << value(any()));
+  auto cs = arguments.compile();
+  std::vector<std::string> args;
+  for (size_t i = 0; i < 10000; ++i) {
+    args.push_back("-I");
+    args.push_back("dir" + std::to_string(i));
+    args.push_back("file" + std::to_string(i));
+  }
+  auto r = cs->parse(args);
+  REQUIRE(r["include"].size() == 10000);
+  REQUIRE(r("include", 9999) == "dir9999");
+  REQUIRE(r["file"].size() == 10000);
+  REQUIRE(r("file", 0) == "file0");
+  REQUIRE(r("file", 9999) == "file9999");
+}
+
+SCENARIO("Scheme entities are allocated in arenas") {
+  using namespace optspp;
+  WHEN("Entities are created by factory functions") {
+    scheme::arena::scope s(std::make_shared<scheme::arena>());
+    auto a = named(name("first"));
+    auto b = value("yes");
+    REQUIRE(scheme::arena::current()->size() == 2);
+    // Each entity has one handle, counting the pointers to it
+    REQUIRE(a.use_count() == 1);
+    auto c = a;
+    REQUIRE(a.use_count() == 2);
+    auto d = scheme::arena::current()->share(a.get());
+    REQUIRE(d == a);
+    REQUIRE(a.use_count() == 3);
+    REQUIRE(b.use_count() == 1);
+  }
+
+  WHEN("A definition is built") {
+    std::weak_ptr<scheme::entity> root;
+    std::weak_ptr<scheme::entity> child;
+    {
+      scheme::definition arguments;
+      for (size_t i = 0; i < 100; ++i) {
+        arguments | (named(name("option" + std::to_string(i))) << value("on") << value("off"));
+      }
+      root = arguments.root();
+      child = arguments.compile()->operator[](1).source;
+      REQUIRE(child.lock().get() == arguments.root()->children()[0]);
+      REQUIRE(arguments.root()->children().size() == 100);
+      REQUIRE((*arguments.root()->children()[99]->children()[1]->known_values())[0] == "off");
+    }
+    THEN("Its entities are freed with it") {
+      REQUIRE(root.expired());
+      REQUIRE(child.expired());
+    }
+  }
+
+  WHEN("A definition is built in its own arena") {
+    scheme::definition arguments;
+    scheme::arena::scope s(arguments);
+    const size_t before = scheme::arena::current()->size();
+    for (size_t i = 0; i < 100; ++i) {
+      arguments | (named(name("option" + std::to_string(i))) << value("on") << value("off"));
+    }
+    THEN("No entity is copied") {
+      REQUIRE(scheme::arena::current()->size() - before == 300);
+      REQUIRE(arguments.root()->children()[0] == arguments.compile()->operator[](1).source.get());
+      arguments.parse(std::vector<std::string>{"--option7", "off"});
+      REQUIRE(arguments["option7"][0] == "off");
+    }
+  }
+
+  WHEN("A long-lived entity was created before many others") {
+    auto kept = named(name("kept"));
+    for (size_t i = 0; i < 4 * scheme::arena::shared_size; ++i) value("v");
+    THEN("It doesn't keep them all allocated") {
+      REQUIRE(scheme::arena::current()->size() < scheme::arena::shared_size);
+      REQUIRE(kept->kind() == scheme::entity::KIND::ARGUMENT);
+    }
+  }
+}
+
+SCENARIO("Composition adopts rvalue subtrees") {
+  using namespace optspp;
+  auto a = std::make_shared<scheme::arena>();
+  scheme::arena::scope s(a);
+  WHEN("An lvalue is added") {
+    auto v = value("x");
+    auto n = named(name("a")) << v;
+    THEN("It is copied") {
+      REQUIRE(n->children()[0] != v.get());
+      auto m = named(name("b")) | v;
+      REQUIRE(m->children()[0] != v.get());
+      REQUIRE(m->children()[0]->siblings_group() == scheme::SIBLINGS_GROUP::OR);
+      REQUIRE(n->children()[0]->siblings_group() == scheme::SIBLINGS_GROUP::XOR);
+    }
+  }
+
+  WHEN("A deep chain is built from temporaries") {
+    const size_t before = a->size();
+    const size_t depth = 200;
+    scheme::entity_ptr level = named(name("level" + std::to_string(depth - 1))) << value("on");
+    for (size_t i = depth - 1; i > 0; --i) {
+      level = named(name("level" + std::to_string(i - 1))) << (value("on") | std::move(level));
+    }
+    THEN("No entity is copied") {
+      REQUIRE(a->size() - before == 2 * depth);
+      const scheme::entity* e = level.get();
+      for (size_t i = 0; i + 1 < depth; ++i) e = e->children()[0]->children()[0];
+      REQUIRE((*e->long_names())[0] == "level" + std::to_string(depth - 1));
+    }
+  }
+
+  WHEN("A temporary aliases a named entity") {
+    auto n = named(name("n")) << value("a");
+    auto v1 = value("x") << (n << value("b"));
+    n << value("d");
+    THEN("Changing the named entity doesn't change the composed subtree") {
+      REQUIRE(v1->children()[0] != n.get());
+      REQUIRE(v1->children()[0]->children().size() == 2);
+      REQUIRE(n->children().size() == 3);
+    }
+  }
+
+  WHEN("A definition is composed from a named entity") {
+    scheme::definition arguments;
+    scheme::arena::scope ds(arguments);
+    auto n = named(name("mode")) << value("fast");
+    arguments | (n << value("slow"));
+    REQUIRE(arguments.root()->children()[0] != n.get());
+    arguments.parse(std::vector<std::string>{"--mode", "slow"});
+    n << value("eco");
+    THEN("Changing the named entity doesn't change the definition") {
+      REQUIRE(arguments.root()->children()[0]->children().size() == 2);
+      REQUIRE_THROWS_AS(arguments.parse(std::vector<std::string>{"--mode", "eco"}), consume_value_failed);
+      arguments.parse(std::vector<std::string>{"--mode", "fast"});
+      REQUIRE(arguments["mode"][0] == "fast");
+    }
+  }
+
+  WHEN("A subtree that already has a parent is moved") {
+    auto n = named(name("a")) << value("x");
+    auto child = a->share(n->children()[0]);
+    auto m = named(name("b")) | std::move(child);
+    THEN("It is copied") {
+      REQUIRE(m->children()[0] != n->children()[0]);
+      REQUIRE(n->children()[0]->siblings_group() == scheme::SIBLINGS_GROUP::XOR);
+    }
+  }
+}
+
+SCENARIO("Static scheme built at compile time") {
+  namespace ss = optspp::static_scheme;
+  constexpr auto cli = ss::definition<>()
+    | (ss::named(ss::name("force"), ss::name('f'), ss::implicit_values("true"), ss::max_count(1))
+       << ss::value("true", {"on", "yes"})
+       << ss::value("false", {"off", "no"}))
+    | (ss::named(ss::name("mode"), ss::name('m'))
+       << (ss::value("fast")
+           | ss::named(ss::name("level", {"lvl"})))
+       << ss::value("slow"))
+    | (ss::positional(ss::name("filename"), ss::min_count(1))
+       << ss::value(optspp::any()));
+  static_assert(cli.nodes.size() == 10, "Nodes are laid out in a flat table");
+  static_assert(cli.index_of("force") == 1, "Lookups are resolved at compile time");
+  static_assert(cli.index_of('m') == 2, "Lookups are resolved at compile time");
+  static_assert(cli.index_of("filename") == 3, "Lookups are resolved at compile time");
+  static_assert(cli.index_of("lvl") == 9, "Any value of level is synthesized before it");
+  static_assert(cli.index_of("missing") == optspp::scheme::compiled_scheme::npos, "Unknown names are not found");
+
+  auto cs = cli.compile();
+  REQUIRE(cs->size() == 11);
+  REQUIRE(cs->named_nodes(cs->name_id("force"))[0] == cli.index_of("force"));
+  REQUIRE(cs->named_nodes(cs->name_id("level"))[0] == cli.index_of("level"));
+
+  WHEN("Parsing with the compiled static scheme") {
+    auto r = cs->parse(std::vector<std::string>{"-f", "--mode", "fast", "--lvl", "3", "file1", "file2"});
+    REQUIRE(r.values(cli.index_of("force"))[0] == "true");
+    REQUIRE(r("mode") == "fast");
+    REQUIRE(r("level") == "3");
+    REQUIRE(r("filename", 1) == "file2");
+    REQUIRE_THROWS_AS(cs->parse(std::vector<std::string>{"--force", "on", "-f", "off", "file"}), optspp::value_conflict);
+    REQUIRE_THROWS_AS(cs->parse(std::vector<std::string>{"-f"}), optspp::actual_counts_mismatch);
+  }
+}
+
+SCENARIO("Concurrent parsing of a shared compiled scheme") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("force"),
+             name('f'),
+             implicit_values("true"),
+             max_count(1))
+       << value("true", {"on", "yes"})
+       << value("false", {"off", "no"}))
+    | (named(name("level"),
+             name('l'))
+       << value("low")
+       << value("high"))
+    | (positional(name("filename"),
+                  min_count(1))
+       << (value(any())));
+  std::shared_ptr<const scheme::compiled_scheme> cs = arguments.compile();
+
+  const size_t threads_count = 8;
+  const size_t iterations = 200;
+  std::vector<size_t> failures(threads_count, 0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < threads_count; ++t) {
+    threads.emplace_back([&cs, &failures, t, iterations] () {
+        scheme::parse_context ctx;
+        for (size_t i = 0; i < iterations; ++i) {
+          const std::string file = "file" + std::to_string(t) + "_" + std::to_string(i);
+          const std::string level = (i % 2 == 0) ? "low" : "high";
+          auto r = cs->parse({"-f", "--level", level, file}, ctx);
+          if ((r["force"].size() != 1) || (r["force"][0] != "true") ||
+              (r["level"].size() != 1) || (r["level"][0] != level) ||
+              (r["filename"].size() != 1) || (r["filename"][0] != file)) ++failures[t];
+        }
+      });
+  }
+  for (auto& t : threads) t.join();
+  for (const auto& f : failures) REQUIRE(f == 0);
+}
+
+SCENARIO("Compiled scheme name index") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    << (positional(name("command"))
+        << (value("add")
+            | (named(name("login", {"user"}), name('l', {'u'}))))
+        << (value("del")
+            | (named(name("login", {"user"}), name('l', {'u'}))))
+        );
+  auto cs = arguments.compile();
+  REQUIRE(cs->name_id("login") != scheme::compiled_scheme::npos);
+  REQUIRE(cs->name_id("user") != scheme::compiled_scheme::npos);
+  REQUIRE(cs->name_id("missing") == scheme::compiled_scheme::npos);
+  REQUIRE(cs->name_id('x') == scheme::compiled_scheme::npos);
+  REQUIRE(cs->named_nodes(cs->name_id("login")).size() == 2);
+  REQUIRE(cs->named_nodes(cs->name_id('u')) == cs->named_nodes(cs->name_id("user")));
+  REQUIRE(cs->named_nodes(cs->name_id("command")).size() == 1);
+
+  WHEN("Many options are defined") {
+    scheme::definition many;
+    for (size_t i = 0; i < 300; ++i) {
+      many | (named(name("option" + std::to_string(i))) << value(any()));
+    }
+    many.parse(std::vector<std::string>{"--option299", "a", "--option0", "b", "--option150", "c"});
+    REQUIRE(many["option299"][0] == "a");
+    REQUIRE(many["option0"][0] == "b");
+    REQUIRE(many["option150"][0] == "c");
+    REQUIRE(many["option1"].size() == 0);
+  }
+
+  WHEN("Results are looked up by synonyms and short names") {
+    auto r = cs->parse(std::vector<std::string>{"del", "-u", "john"});
+    REQUIRE(r["login"].size() == 1);
+    REQUIRE(r("user") == "john");
+    REQUIRE(r('l') == "john");
+    REQUIRE(r('u', 0) == "john");
+    REQUIRE(r("command") == "del");
+    REQUIRE(r[std::string_view("login")].size() == 1);
+    REQUIRE(r['x'].size() == 0);
+    REQUIRE_THROWS_AS(r("missing"), value_not_found);
+    REQUIRE_THROWS_AS(r('l', 1), value_not_found);
+  }
+}
+
+SCENARIO("Tokenizer classifies separators, clusters and terminator") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("force"),
+             name('f'),
+             implicit_values("true"))
+       << value("true", {"on", "yes"})
+       << value("false", {"off", "no"}))
+    | (named(name("output"),
+             name('o'))
+       << value(any()))
+    | (positional(name("filename"))
+       << (value(any())));
+
+  THEN("--force=off -o=out.txt a=b") {
+    arguments.parse(std::vector<std::string>{"--force=off", "-o=out.txt", "a=b"});
+    REQUIRE(arguments["force"][0] == "false");
+    REQUIRE(arguments["output"][0] == "out.txt");
+    REQUIRE(arguments["filename"][0] == "a=b");
+  }
+
+  THEN("--output=x=y") {
+    arguments.parse(std::vector<std::string>{"--output=x=y"});
+    REQUIRE(arguments["output"][0] == "x=y");
+  }
+
+  THEN("-fo=out.txt") {
+    arguments.parse(std::vector<std::string>{"-fo=out.txt"});
+    REQUIRE(arguments["force"][0] == "true");
+    REQUIRE(arguments["output"][0] == "out.txt");
+  }
+
+  THEN("-f -- -o --force -") {
+    arguments.parse(std::vector<std::string>{"-f", "--", "-o", "--force", "-"});
+    REQUIRE(arguments["force"].size() == 1);
+    REQUIRE(arguments["output"].size() == 0);
+    REQUIRE(arguments["filename"] == std::vector<std::string>({"-o", "--force", "-"}));
+  }
+
+  THEN("--force=maybe") {
+    REQUIRE_THROWS_AS(arguments.parse(std::vector<std::string>{"--force=maybe"}), consume_value_failed);
+  }
+
+  THEN("Unparsed tokens are reported as given") {
+    try {
+      arguments.parse(std::vector<std::string>{"--unknown=1", "-xf"});
+      FAIL("unparsed_tokens not thrown");
+    } catch (const unparsed_tokens& e) {
+      REQUIRE(e.tokens.size() == 2);
+      REQUIRE(e.tokens[0].s == "--unknown=1");
+      REQUIRE(e.tokens[0].pos_arg_num == 0);
+      REQUIRE(e.tokens[1].s == "-x");
+      REQUIRE(e.tokens[1].pos_arg_num == 1);
+      REQUIRE(e.tokens[1].pos_in_arg == 1);
+    }
+  }
+}
+
+SCENARIO("Zero-copy parse over argv") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("force"),
+             name('f'),
+             implicit_values("true"))
+       << value("true", {"on", "yes"})
+       << value("false", {"off", "no"}))
+    | (named(name("output"),
+             name('o'))
+       << value(any()))
+    | (positional(name("filename"))
+       << (value(any())));
+  auto cs = arguments.compile();
+
+  WHEN("Parsing argv in place") {
+    const char* argv[] = {"prog", "--output=out.txt", "-f", "no", "file1", "file2"};
+    auto r = cs->parse_view(6, argv);
+    THEN("Values view the arguments") {
+      REQUIRE(r["output"][0] == "out.txt");
+      REQUIRE(r["output"][0].data() == argv[1] + 9);
+      REQUIRE(r["filename"][0].data() == argv[4]);
+      REQUIRE(r["filename"][1].data() == argv[5]);
+    }
+    THEN("Synonyms are normalised to the scheme's main value") {
+      REQUIRE(r["force"][0] == "false");
+      const auto& force = (*cs)[cs->named_nodes(cs->name_id("force"))[0]];
+      const auto& false_value = (*cs)[force.first_child + 1];
+      REQUIRE(r["force"][0].data() == (*false_value.source->known_values())[0].data());
+    }
+  }
+
+  WHEN("Parsing caller-owned views") {
+    const std::string buffer("-f file1");
+    const std::vector<std::string_view> args{std::string_view(buffer).substr(0, 2), std::string_view(buffer).substr(3)};
+    auto r = cs->parse_view(args);
+    REQUIRE(r["force"][0] == "true");
+    REQUIRE(r["filename"][0].data() == buffer.data() + 3);
+  }
+
+  WHEN("Copying parse outlives its arguments") {
+    scheme::parse_result r;
+    {
+      std::vector<std::string> args{"--output", "a-long-output-file-name-that-is-not-short.txt"};
+      r = cs->parse(args);
+    }
+    auto copy = r;
+    REQUIRE(copy["output"][0] == "a-long-output-file-name-that-is-not-short.txt");
+  }
+}
+
+SCENARIO("Typed value extraction") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("jobs"),
+             name('j'),
+             implicit_values("1"))
+       << value(any()))
+    | (named(name("ratio"))
+       << value(any()))
+    | (positional(name("size"))
+       << (value(any())));
+
+  WHEN("Values are numbers") {
+    arguments.parse(std::vector<std::string>{"--jobs", "8", "--ratio=0.25", "10", "--", "-20", "30"});
+    THEN("They are converted to the requested type") {
+      REQUIRE(arguments.get<int>("jobs") == 8);
+      REQUIRE(arguments.get<unsigned long>('j') == 8);
+      REQUIRE(arguments.get<double>("ratio") == 0.25);
+      REQUIRE(arguments.get<float>("ratio") == 0.25f);
+      REQUIRE(arguments.get<long long>("size", 1) == -20);
+      REQUIRE(arguments.get_all<int>("size") == std::vector<int>{10, -20, 30});
+      REQUIRE(arguments.get<std::string>("size", 2) == "30");
+      REQUIRE(arguments.get_all<short>("unknown").empty());
+    }
+    THEN("Out of range and malformed values throw with the token position") {
+      REQUIRE_THROWS_AS(arguments.get<unsigned>("size", 1), value_conversion_failed);
+      REQUIRE_THROWS_AS(arguments.get<int>("ratio"), value_conversion_failed);
+      try {
+        arguments.get<unsigned>("size", 1);
+      } catch (const value_conversion_failed& e) {
+        REQUIRE(e.value == "-20");
+        REQUIRE(e.pos_arg_num == 5);
+        REQUIRE(e.pos_in_arg == 0);
+      }
+      REQUIRE_THROWS_AS(arguments.get<int>("size", 3), value_not_found);
+    }
+  }
+
+  WHEN("A value is taken from an implicit value or a cluster") {
+    auto cs = arguments.compile();
+    const std::vector<std::string> input{"--ratio", "x", "-j"};
+    auto r = cs->parse(input);
+    REQUIRE(r.get<int>('j') == 1);
+    REQUIRE(r.positions(r.find('j'))[0].pos_arg_num == 2);
+    REQUIRE(r.positions(r.find('j'))[0].pos_in_arg == 1);
+    try {
+      r.get<double>("ratio");
+      FAIL("Conversion should have failed");
+    } catch (const value_conversion_failed& e) {
+      REQUIRE(e.name == "ratio");
+      REQUIRE(e.pos_arg_num == 1);
+    }
+  }
+
+  WHEN("A result is converted from several threads") {
+    auto cs = arguments.compile();
+    std::vector<std::string> input;
+    for (size_t i = 0; i < 1000; ++i) input.push_back(std::to_string(i));
+    const auto r = cs->parse(input);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> mismatches{0};
+    for (size_t t = 0; t < 4; ++t) {
+      threads.emplace_back([&r, &mismatches, t] () {
+          const auto ints = r.get_all<int>("size");
+          const auto doubles = r.get_all<double>("size");
+          for (size_t i = 0; i < ints.size(); ++i) {
+            if ((ints[i] != int(i)) || (doubles[i] != double(i))) ++mismatches;
+          }
+          if (r.get<long>("size", t) != long(t)) ++mismatches;
+        });
+    }
+    for (auto& t : threads) t.join();
+    REQUIRE(mismatches == 0);
+    REQUIRE(r.get<int>("size", 999) == 999);
+  }
+}
+
+SCENARIO("Value synonyms are hash indexed") {
+  using namespace optspp;
+  auto codec = named(name("codec"), name('c'));
+  for (size_t i = 0; i < 300; ++i) {
+    codec | value("codec" + std::to_string(i), {"c" + std::to_string(i), "alias" + std::to_string(i)});
+  }
+  scheme::definition arguments;
+  arguments
+    | std::move(codec)
+    | (named(name("mode"))
+       << value("fast", {"quick"})
+       << value("fast-any", {"quick"})
+       << value(any()));
+  auto cs = arguments.compile();
+  const auto codec_node = cs->named_nodes(cs->name_id("codec"))[0];
+  const auto mode_node = cs->named_nodes(cs->name_id("mode"))[0];
+
+  WHEN("Looking up synonyms in the compiled scheme") {
+    auto k = cs->find_known_value(codec_node, "alias299");
+    REQUIRE(k != nullptr);
+    REQUIRE(k->main == "codec299");
+    REQUIRE(k->node == (*cs)[codec_node].first_child + 299);
+    REQUIRE(cs->find_known_value(codec_node, "codec300") == nullptr);
+    THEN("The first value listing a synonym takes it") {
+      REQUIRE(cs->find_known_value(mode_node, "quick")->main == "fast");
+      REQUIRE((*cs)[mode_node].any_value == (*cs)[mode_node].first_child + 2);
+      REQUIRE((*cs)[codec_node].any_value == scheme::compiled_scheme::npos);
+    }
+  }
+
+  WHEN("Parsing synonyms") {
+    const std::vector<std::string> input{"--codec", "c17", "--mode=quick", "-c", "alias5"};
+    auto r = cs->parse(input);
+    REQUIRE(r["codec"] == std::vector<std::string_view>{"codec17", "codec5"});
+    REQUIRE(r["mode"][0] == "fast");
+    const std::vector<std::string> unknown{"--codec", "c300"};
+    REQUIRE_THROWS_AS(cs->parse(unknown), consume_value_failed);
+  }
+}
+
+SCENARIO("Batch parsing") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("force"),
+             name('f'),
+             implicit_values("true"))
+       << value("true", {"on", "yes"})
+       << value("false", {"off", "no"}))
+    | (positional(name("filename"))
+       << (value(any())));
+  auto cs = arguments.compile();
+
+  std::vector<std::vector<std::string>> batch;
+  for (size_t i = 0; i < 1000; ++i) {
+    if (i % 10 == 3) {
+      batch.push_back({"--force=maybe", "file"});
+    } else {
+      batch.push_back({"-f", i % 2 ? "on" : "off", "file" + std::to_string(i)});
+    }
+  }
+
+  WHEN("Parsing a batch on several threads") {
+    auto rs = cs->parse_batch(batch, 4);
+    REQUIRE(rs.size() == batch.size());
+    THEN("Each command line has its result or error, in order") {
+      for (size_t i = 0; i < rs.size(); ++i) {
+        if (i % 10 == 3) {
+          REQUIRE(!rs[i]);
+          REQUIRE(rs[i].error().code == error_code::CONSUME_VALUE_FAILED);
+          REQUIRE_THROWS_AS(rs[i].error().raise(), consume_value_failed);
+        } else {
+          REQUIRE(rs[i]);
+          REQUIRE((*rs[i])["force"][0] == (i % 2 ? "true" : "false"));
+          REQUIRE((*rs[i])["filename"][0] == "file" + std::to_string(i));
+        }
+      }
+    }
+  }
+
+  WHEN("Parsing a batch of views with the default thread count") {
+    std::vector<std::vector<std::string_view>> views;
+    for (const auto& args : batch) views.emplace_back(args.begin(), args.end());
+    auto rs = cs->parse_batch_view(views);
+    REQUIRE(rs.size() == batch.size());
+    REQUIRE((*rs[999])["filename"][0].data() == batch[999][2].data());
+    REQUIRE(cs->parse_batch_view({}).empty());
+  }
+}
+
+SCENARIO("Response files") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("output"),
+             name('o'))
+       << value(any()))
+    | (positional(name("object"))
+       << (value(any())));
+  auto cs = arguments.compile();
+
+  const auto dir = std::filesystem::temp_directory_path();
+  const auto objects = (dir / "optspp_test_objects.rsp").string();
+  const auto nested = (dir / "optspp_test_nested.rsp").string();
+  {
+    std::ofstream f(objects);
+    for (size_t i = 0; i < 10000; ++i) f << "obj" << i << ".o\n";
+    f << "'with space.o' \"quoted \\\"x\\\".o\" esc\\ aped.o\n";
+  }
+  {
+    std::ofstream f(nested);
+    f << "-o out\t@" << objects << "\n";
+  }
+
+  WHEN("Expanding a response file given on the command line") {
+    const std::string arg = "@" + nested;
+    const std::vector<std::string_view> input{"first.o", arg, "@missing-optspp-file", "last.o"};
+    auto rf = std::make_shared<const response_files>(input);
+    THEN("Its arguments replace it, nested files included") {
+      const auto& args = rf->args();
+      REQUIRE(args.size() == 10008);
+      REQUIRE(args[0] == "first.o");
+      REQUIRE(args[1] == "-o");
+      REQUIRE(args[2] == "out");
+      REQUIRE(args[3] == "obj0.o");
+      REQUIRE(args[10002] == "obj9999.o");
+      REQUIRE(args[10003] == "with space.o");
+      REQUIRE(args[10004] == "quoted \"x\".o");
+      REQUIRE(args[10005] == "esc aped.o");
+      REQUIRE(args[10006] == "@missing-optspp-file");
+      REQUIRE(args.back() == "last.o");
+    }
+    THEN("The result keeps the files") {
+      scheme::parse_result r;
+      {
+        auto owned = std::make_shared<const response_files>(input);
+        r = cs->parse(owned);
+      }
+      REQUIRE(r["output"][0] == "out");
+      REQUIRE(r["object"].size() == 10006);
+      REQUIRE(r["object"][10000] == "obj9999.o");
+    }
+  }
+
+  WHEN("A response file includes itself") {
+    const auto loop = (dir / "optspp_test_loop.rsp").string();
+    {
+      std::ofstream f(loop);
+      f << "@" << loop;
+    }
+    const std::string arg = "@" + loop;
+    REQUIRE_THROWS_AS(response_files(std::vector<std::string_view>{arg}), response_file_error);
+    std::remove(loop.c_str());
+  }
+
+  std::remove(objects.c_str());
+  std::remove(nested.c_str());
+}
+
+SCENARIO("Exception messages are formatted on demand") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("force"),
+             name('f'),
+             max_count(1))
+       << value("true", {"on", "yes"})
+       << value("false", {"off", "no"}));
+  auto cs = arguments.compile();
+
+  WHEN("Parse fails") {
+    const std::vector<std::string> input{"-f", "on", "-f", "on"};
+    try {
+      cs->parse(input);
+      FAIL("Parse should have failed");
+    } catch (const actual_counts_mismatch& e) {
+      THEN("The message is built once") {
+        REQUIRE(e.records.size() == 1);
+        REQUIRE(std::string(e.what()) == "Actual argument value counts mismatch. Argument force/f maximum expected 1, actual 2.");
+        REQUIRE(e.what() == e.message().c_str());
+      }
+    }
+  }
+
+  WHEN("Errors are copied before formatting") {
+    value_not_found e("force", 3);
+    auto copy = e;
+    REQUIRE(std::string(copy.what()) == "Index 3 for argument 'force' is out bounds");
+    REQUIRE(std::string(value_not_found("force").what()) == "Argument 'force' has no values");
+    REQUIRE(std::string(scheme_error("bad").what()) == "bad");
+    REQUIRE(scheme_error("bad").message() == "bad");
+  }
+
+  WHEN("The message is read from several threads") {
+    const value_not_found e("force", 3);
+    std::vector<std::thread> threads;
+    std::vector<const char*> whats(4);
+    for (size_t t = 0; t < whats.size(); ++t) {
+      threads.emplace_back([&e, &whats, t] () { whats[t] = e.what(); });
+    }
+    for (auto& t : threads) t.join();
+    for (const auto w : whats) REQUIRE(w == e.message().c_str());
+    REQUIRE(e.message() == "Index 3 for argument 'force' is out bounds");
+  }
+}
+
+SCENARIO("Parsing without exceptions") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("force"),
+             name('f'),
+             max_count(1))
+       << value("true", {"on", "yes"})
+       << value("false", {"off", "no"}))
+    | (named(name("recursive"),
+             name('r'),
+             implicit_values("true"))
+       << value("true")
+       << value("false"))
+    | (positional(name("filename"), min_count(1))
+       << (value(any())));
+  auto cs = arguments.compile();
+
+  WHEN("Parse succeeds") {
+    auto r = cs->try_parse(std::vector<std::string>{"-r", "-f", "on", "file"});
+    REQUIRE(r);
+    REQUIRE((*r)["recursive"][0] == "true");
+    REQUIRE(r->positionals().size() == 1);
+  }
+
+  WHEN("Parse fails") {
+    THEN("Errors hold the code, the argument and the token position") {
+      auto r = cs->try_parse(std::vector<std::string>{"file", "--force=maybe"});
+      REQUIRE(!r);
+      REQUIRE(r.error().code == error_code::CONSUME_VALUE_FAILED);
+      REQUIRE((*r.error().entity->long_names())[0] == "force");
+      REQUIRE(r.error().pos_arg_num == 1);
+
+      r = cs->try_parse_view(std::vector<std::string_view>{"file", "-f", "on", "-f", "off"});
+      REQUIRE(r.error().code == error_code::VALUE_CONFLICT);
+      REQUIRE(r.error().value == "off");
+      REQUIRE(r.error().pos_arg_num == 4);
+      REQUIRE(r.error().pos_in_arg == 0);
+
+      r = cs->try_parse(std::vector<std::string>{"file", "-f"});
+      REQUIRE(r.error().code == error_code::NO_IMPLICIT_VALUE);
+      REQUIRE(r.error().pos_arg_num == 1);
+      REQUIRE(r.error().pos_in_arg == 1);
+
+      r = cs->try_parse(std::vector<std::string>{"file", "--unknown", "-x"});
+      REQUIRE(r.error().code == error_code::UNPARSED_TOKENS);
+      REQUIRE(r.error().tokens().size() == 2);
+      REQUIRE(r.error().tokens()[1].s == "-x");
+      REQUIRE(r.error().pos_arg_num == 1);
+
+      r = cs->try_parse(std::vector<std::string>{"-r"});
+      REQUIRE(r.error().code == error_code::ACTUAL_COUNTS_MISMATCH);
+      REQUIRE(r.error().records.size() == 1);
+      REQUIRE(r.error().records[0].actual == 0);
+    }
+    THEN("Raising the error throws what parse throws") {
+      auto r = cs->try_parse(std::vector<std::string>{"file", "-f", "on", "-f", "off"});
+      REQUIRE_THROWS_AS(r.error().raise(), value_conflict);
+      REQUIRE_THROWS_AS(cs->parse(std::vector<std::string>{"file", "-f", "on", "-f", "off"}), value_conflict);
+    }
+    THEN("Definitions report the error") {
+      auto e = arguments.try_parse(std::vector<std::string>{"file", "--force"});
+      REQUIRE(e);
+      REQUIRE((*e).code == error_code::NO_IMPLICIT_VALUE);
+      REQUIRE(!arguments.try_parse(std::vector<std::string>{"file", "--force", "no"}));
+      REQUIRE(arguments["force"][0] == "false");
+    }
+  }
+}
+
+SCENARIO("Parser work grows linearly") {
+  using namespace optspp;
+  using counters = scheme::parse_context::work_counters;
+  auto work = [] (const scheme::compiled_scheme& cs, const std::vector<std::string>& args) {
+    scheme::parse_context ctx;
+    cs.parse(args, ctx);
+    return ctx.counters();
+  };
+  // Doubling the input at most doubles each counter, give or take a constant
+  auto linear = [] (const counters& a, const counters& b) {
+    const size_t slack = 64;
+    return (b.passes <= 2 * a.passes + slack) &&
+      (b.nodes_visited <= 2 * a.nodes_visited + slack) &&
+      (b.tokens_scanned <= 2 * a.tokens_scanned + slack);
+  };
+
+  WHEN("Options with separators, clusters and positionals") {
+    auto make_args = [] (const size_t n) {
+      std::vector<std::string> rslt;
+      for (size_t i = 0; i < n; ++i) {
+        if (i % 3 == 0) rslt.push_back("--opt" + std::to_string(i % 20) + "=v");
+        else if (i % 3 == 1) rslt.push_back("-abc");
+        else rslt.push_back("file" + std::to_string(i));
+      }
+      return rslt;
+    };
+    scheme::definition arguments;
+    for (size_t i = 0; i < 20; ++i) {
+      auto o = named(name("opt" + std::to_string(i)));
+      if (i < 3) {
+        o->apply_property(name(char('a' + i)));
+        implicit_values iv("1");
+        (*iv.values).assign(2000, "1");
+        o->apply_property(iv);
+      }
+      arguments | (std::move(o) << value(any()));
+    }
+    arguments | (positional(name("file")) << value(any()));
+    auto cs = arguments.compile();
+    auto c1 = work(*cs, make_args(1000));
+    auto c2 = work(*cs, make_args(2000));
+    auto c4 = work(*cs, make_args(4000));
+    REQUIRE(c1.tokens_scanned > 0);
+    REQUIRE(linear(c1, c2));
+    REQUIRE(linear(c2, c4));
+  }
+
+  WHEN("Positionals with known values follow many others") {
+    scheme::definition arguments;
+    arguments
+      | (positional(name("command")) << value("start") << value("stop"))
+      | (positional(name("file")) << value(any()));
+    auto cs = arguments.compile();
+    auto make_args = [] (const size_t n) {
+      std::vector<std::string> rslt;
+      for (size_t i = 0; i + 1 < n; ++i) rslt.push_back("file" + std::to_string(i));
+      rslt.push_back("stop");
+      return rslt;
+    };
+    auto c1 = work(*cs, make_args(1000));
+    auto c2 = work(*cs, make_args(2000));
+    REQUIRE(linear(c1, c2));
+  }
+
+  WHEN("Named arguments are nested in XOR trees") {
+    auto make_scheme = [] (const size_t depth) {
+      scheme::entity_ptr child;
+      for (size_t i = depth; i-- > 0;) {
+        auto x = value("x");
+        if (child) x << std::move(child);
+        child = named(name("level" + std::to_string(i))) << std::move(x) << value("y");
+      }
+      scheme::definition arguments;
+      arguments | std::move(child);
+      return arguments.compile();
+    };
+    auto make_args = [] (const size_t depth) {
+      std::vector<std::string> rslt;
+      // Deepest options first, each is taken in the same pass once its parent value is
+      for (size_t i = depth; i-- > 0;) {
+        rslt.push_back("--level" + std::to_string(i));
+        rslt.push_back("x");
+      }
+      return rslt;
+    };
+    auto c1 = work(*make_scheme(50), make_args(50));
+    auto c2 = work(*make_scheme(100), make_args(100));
+    REQUIRE(c1.passes == 1);
+    REQUIRE(linear(c1, c2));
+  }
+
+  WHEN("The scheme grows and the command line does not") {
+    auto make_scheme = [] (const size_t n) {
+      scheme::definition arguments;
+      for (size_t i = 0; i < n; ++i) arguments | (named(name("opt" + std::to_string(i))) << value(any()));
+      return arguments.compile();
+    };
+    const std::vector<std::string> args{"--opt0=a", "--opt7=b", "--opt3=c"};
+    auto c1 = work(*make_scheme(100), args);
+    auto c2 = work(*make_scheme(200), args);
+    REQUIRE(c1.tokens_scanned == c2.tokens_scanned);
+    REQUIRE(c1.nodes_visited == c2.nodes_visited);
+  }
+
+  WHEN("Positionals follow many sibling options") {
+    auto make_scheme = [] (const size_t n) {
+      scheme::definition arguments;
+      for (size_t i = 0; i < n; ++i) arguments | (named(name("opt" + std::to_string(i))) << value(any()));
+      arguments | (positional(name("file")) << value(any()));
+      return arguments.compile();
+    };
+    std::vector<std::string> args{"--opt3", "a"};
+    for (size_t i = 0; i < 2000; ++i) args.push_back("file" + std::to_string(i));
+    auto c1 = work(*make_scheme(10), args);
+    auto c2 = work(*make_scheme(1000), args);
+    // The root takes all the positionals in one pass, without scanning the options
+    REQUIRE(c1.passes <= 2);
+    REQUIRE(c1.passes == c2.passes);
+    REQUIRE(c1.nodes_visited == c2.nodes_visited);
+    REQUIRE(c1.tokens_scanned == c2.tokens_scanned);
+  }
+
+  WHEN("Positionals have many known values") {
+    auto make_scheme = [] (const size_t n) {
+      auto a = positional(name("word"));
+      for (size_t i = 0; i < n; ++i) a | value("w" + std::to_string(i));
+      scheme::definition arguments;
+      arguments | a;
+      return arguments.compile();
+    };
+    std::vector<std::string> args;
+    for (size_t i = 0; i < 2000; ++i) args.push_back("w" + std::to_string(i % 3));
+    auto c1 = work(*make_scheme(3), args);
+    auto c2 = work(*make_scheme(1200), args);
+    // Each token is looked up once, whatever the number of values
+    REQUIRE(c1.tokens_scanned == c2.tokens_scanned);
+    REQUIRE(c1.nodes_visited == c2.nodes_visited);
+  }
+}
+
+SCENARIO("XOR groups spanning several bitset words") {
+  using namespace optspp;
+  scheme::definition arguments;
+  // 70 flags before the mode argument push its 150 XOR values over three 64-bit words
+  for (size_t i = 0; i < 70; ++i) arguments | named(name("flag" + std::to_string(i)), implicit_values("1"));
+  auto mode = named(name("mode"), max_count(2));
+  for (size_t i = 0; i < 150; ++i) mode << value("m" + std::to_string(i));
+  arguments | std::move(mode);
+  auto cs = arguments.compile();
+
+  WHEN("The same value is given twice") {
+    auto r = cs->parse(std::vector<std::string>{"--mode", "m140", "--flag3", "--mode", "m140"});
+    THEN("Both are taken") {
+      REQUIRE(r["mode"].size() == 2);
+      REQUIRE(r["flag3"][0] == "1");
+    }
+  }
+  WHEN("Values from different words of the group are given") {
+    auto r = cs->try_parse(std::vector<std::string>{"--mode", "m1", "--mode", "m140"});
+    THEN("They conflict") {
+      REQUIRE(!r);
+      REQUIRE(r.error().code == error_code::VALUE_CONFLICT);
+    }
+  }
+  WHEN("Values from the same word of the group are given") {
+    scheme::parse_context ctx;
+    auto r = cs->try_parse(std::vector<std::string>{"--mode", "m100", "--mode", "m101"}, ctx);
+    THEN("They conflict and the rest of the group is blocked") {
+      REQUIRE(!r);
+      REQUIRE(r.error().code == error_code::VALUE_CONFLICT);
+      const auto& m = (*cs)[cs->named_nodes(cs->name_id("mode"))[0]];
+      REQUIRE(ctx.color(m.first_child + 100) == scheme::parse_context::COLOR::BORDER);
+      REQUIRE(ctx.color(m.first_child) == scheme::parse_context::COLOR::BLOCKED);
+      REQUIRE(ctx.color(m.first_child + 149) == scheme::parse_context::COLOR::BLOCKED);
+    }
+  }
+}
+
+SCENARIO("Scheme is validated once when finalized") {
+  using namespace optspp;
+  WHEN("A descendant reuses an ancestor's name") {
+    scheme::definition arguments;
+    arguments | (named(name("mode"), name('m')) << (value("a") << named(name("level"), name('m'))));
+    THEN("Finalizing throws") {
+      REQUIRE_THROWS_AS(arguments.finalize(), scheme_error);
+    }
+  }
+  WHEN("Arguments on different branches share a name") {
+    scheme::definition arguments;
+    arguments
+      | (named(name("mode")) << (value("a") << named(name("level"), name('l')))
+                             << (value("b") << named(name("level"), name('l'))));
+    THEN("The scheme is valid") {
+      REQUIRE_NOTHROW(arguments.finalize());
+    }
+  }
+  WHEN("A branch is deep") {
+    scheme::entity_ptr child;
+    for (size_t i = 2000; i-- > 0;) {
+      auto x = value("x");
+      if (child) x << std::move(child);
+      child = named(name("level" + std::to_string(i)), name(char('a' + i % 26))) << std::move(x);
+    }
+    scheme::definition arguments;
+    arguments | std::move(child);
+    THEN("Reused short names are found deep down") {
+      REQUIRE_THROWS_AS(arguments.finalize(), scheme_error);
+    }
+  }
+  WHEN("Finalized scheme is parsed") {
+    scheme::definition arguments;
+    arguments | (named(name("force"), implicit_values("true")) << value("true") << value("false"));
+    auto cs = arguments.finalize();
+    arguments.parse(std::vector<std::string>{"--force"});
+    THEN("Parse uses the kept scheme") {
+      REQUIRE(arguments.finalize() == cs);
+      REQUIRE(arguments["force"][0] == "true");
+    }
+    THEN("Modifying the definition drops it") {
+      arguments | named(name("verbose"), implicit_values("1"));
+      REQUIRE(arguments.finalize() != cs);
+    }
+  }
+}
+
+SCENARIO("Completion of partial command lines") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("output"), name('o')) << value(any()))
+    | (named(name("optimize"), name('O')) << value("speed") << value("size", {"small"}))
+    | (named(name("verbose"), name('v'), implicit_values("true")) << value("true") << value("false"))
+    | (positional(name("command"))
+       << (value("start") << named(name("port")))
+       << (value("stop") << named(name("force"), implicit_values("true"))));
+  auto cs = arguments.compile();
+  using candidates = std::vector<std::string>;
+
+  WHEN("Completing long names") {
+    THEN("Names with the prefix are returned in order") {
+      REQUIRE(cs->complete({"--o"}) == candidates{"--optimize", "--output"});
+      REQUIRE(cs->complete({"--verb"}) == candidates{"--verbose"});
+      REQUIRE(cs->complete({"--x"}).empty());
+    }
+  }
+  WHEN("Completing short names") {
+    REQUIRE(cs->complete({"-O"}) == candidates{"-O"});
+    REQUIRE(cs->complete({"-"}) == candidates{"--optimize", "--output", "--verbose", "-O", "-o", "-v"});
+  }
+  WHEN("Completing values") {
+    THEN("Values of the preceding option and attached values are completed with their synonyms") {
+      REQUIRE(cs->complete({"--optimize", "s"}) == candidates{"size", "small", "speed"});
+      REQUIRE(cs->complete({"-O", "sp"}) == candidates{"speed"});
+      REQUIRE(cs->complete({"--optimize=si"}) == candidates{"--optimize=size"});
+    }
+    THEN("Options with implicit values may be followed by other arguments") {
+      const auto c = cs->complete({"-v", ""});
+      REQUIRE(std::find(c.begin(), c.end(), "false") != c.end());
+      REQUIRE(std::find(c.begin(), c.end(), "--output") != c.end());
+    }
+    THEN("Known positional values are completed") {
+      REQUIRE(cs->complete({"st"}) == candidates{"start", "stop"});
+      REQUIRE(cs->complete({"--", "st"}) == candidates{"start", "stop"});
+    }
+    THEN("Values of other arguments with the prefix are not offered") {
+      REQUIRE(cs->complete({"--optimize", "st"}).empty());
+      REQUIRE(cs->complete({"--optimize=st"}).empty());
+      REQUIRE(cs->complete({"--verbose", "t"}) == candidates{"true"});
+    }
+  }
+  WHEN("A branch was taken") {
+    THEN("Arguments of the taken branch are offered, XOR siblings are not") {
+      REQUIRE(cs->complete({"--"}) == candidates{"--optimize", "--output", "--verbose"});
+      REQUIRE(cs->complete({"start", "--"}) == candidates{"--optimize", "--output", "--port", "--verbose"});
+      REQUIRE(cs->complete({"stop", "--f"}) == candidates{"--force"});
+      REQUIRE(cs->complete({"start", "st"}) == candidates{"start"});
+      REQUIRE(cs->complete({"--verbose", "false", "--verbose", "t"}).empty());
+    }
+  }
+  WHEN("The command line does not parse") {
+    THEN("Nothing is thrown") {
+      REQUIRE_NOTHROW(cs->complete({"--unknown", "stray", "--o"}));
+      REQUIRE_NOTHROW(cs->complete({}));
+    }
+  }
+}
+
+SCENARIO("Abbreviated long names") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | named(name("recursive"), name('r'), implicit_values("true"))
+    | named(name("record"), implicit_values("true"))
+    | named(name("verbose"), name("verbosity"), implicit_values("true"))
+    | (named(name("output")) << value(any()))
+    | (positional(name("outfile")) << value(any()));
+
+  WHEN("Abbreviations are not allowed") {
+    THEN("Only exact names are taken") {
+      REQUIRE_THROWS_AS(arguments.parse(std::vector<std::string>{"--recur"}), unparsed_tokens);
+    }
+  }
+  WHEN("Abbreviations are allowed") {
+    arguments.allow_abbreviations();
+    THEN("Unique prefixes resolve to their argument") {
+      arguments.parse(std::vector<std::string>{"--recur", "--out=a.txt", "b.txt"});
+      REQUIRE(arguments["recursive"][0] == "true");
+      REQUIRE(arguments["output"][0] == "a.txt");
+      REQUIRE(arguments["outfile"][0] == "b.txt");
+    }
+    THEN("Prefixes of synonyms of one argument are not ambiguous") {
+      arguments.parse(std::vector<std::string>{"--verb"});
+      REQUIRE(arguments["verbose"][0] == "true");
+    }
+    THEN("Exact names win over longer ones") {
+      arguments.parse(std::vector<std::string>{"--record"});
+      REQUIRE(arguments["record"][0] == "true");
+      REQUIRE(arguments["recursive"].size() == 0);
+    }
+    THEN("Ambiguous prefixes are reported with all candidates") {
+      auto e = arguments.try_parse(std::vector<std::string>{"--verbose", "--rec"});
+      REQUIRE(e);
+      REQUIRE((*e).code == error_code::AMBIGUOUS_ABBREVIATION);
+      REQUIRE((*e).value == "rec");
+      REQUIRE((*e).pos_arg_num == 1);
+      REQUIRE((*e).candidates.size() == 2);
+      REQUIRE_THROWS_WITH(arguments.parse(std::vector<std::string>{"--re"}),
+                          "Argument name 're' is ambiguous, candidates: recursive/r, record");
+    }
+    THEN("Unknown names are still unparsed") {
+      REQUIRE_THROWS_AS(arguments.parse(std::vector<std::string>{"--x"}), unparsed_tokens);
+    }
+  }
+}
+
+SCENARIO("Short option clusters with attached values") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | named(name("verbose"), name('v'), implicit_values("true"))
+    | named(name("recursive"), name('r'), implicit_values("true"))
+    | (named(name("output"), name('o')) << value(any()))
+    | (named(name("optimize"), name('O')) << value("0") << value("2") << value("s"))
+    | (positional(name("file")) << value(any()));
+  auto cs = arguments.compile();
+
+  WHEN("An option that requires a value is followed by more characters") {
+    auto r = cs->parse(std::vector<std::string>{"-ofile.o", "-O2", "-vrofile=x", "a.c"});
+    THEN("The rest of the argument is its value") {
+      REQUIRE(r["output"] == std::vector<std::string_view>({"file.o", "file=x"}));
+      REQUIRE(r["optimize"][0] == "2");
+      REQUIRE(r["verbose"][0] == "true");
+      REQUIRE(r["recursive"][0] == "true");
+      REQUIRE(r["file"][0] == "a.c");
+      const auto o = cs->named_nodes(cs->name_id('o'))[0];
+      REQUIRE(r.positions(o)[1].pos_arg_num == 2);
+      REQUIRE(r.positions(o)[1].pos_in_arg == 3);
+    }
+  }
+  WHEN("An attached value is not a known value") {
+    THEN("The option fails to take it") {
+      REQUIRE_THROWS_AS(cs->parse(std::vector<std::string>{"-O3"}), consume_value_failed);
+    }
+  }
+  WHEN("Long lines of clusters are parsed") {
+    auto work = [] (const size_t n) {
+      scheme::definition many;
+      for (const char c : {'v', 'r'}) {
+        implicit_values iv("true");
+        (*iv.values).assign(n, "true");
+        many | named(name(c), iv);
+      }
+      many | (named(name('o')) << value(any()));
+      std::vector<std::string> args;
+      for (size_t i = 0; i < n; ++i) args.push_back("-vro" + std::to_string(i));
+      scheme::parse_context ctx;
+      auto many_cs = many.compile();
+      auto r = many_cs->parse(args, ctx);
+      REQUIRE(r['o'].size() == n);
+      return ctx.counters();
+    };
+    THEN("The work grows linearly") {
+      const auto a = work(1000);
+      const auto b = work(2000);
+      REQUIRE(a.tokens_scanned >= 3000);
+      REQUIRE(b.tokens_scanned <= 2 * a.tokens_scanned + 64);
+      REQUIRE(b.nodes_visited <= 2 * a.nodes_visited + 64);
+    }
+  }
+}
+
+SCENARIO("Definition modified after parsing") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments | (named(name("output"), name('o')) << value(any()));
+  arguments.parse(std::vector<std::string>{"-o", "a.out"});
+  arguments | named(name("verbose"), implicit_values("true"));
+  THEN("Results of the last parse stay readable") {
+    REQUIRE(arguments["output"][0] == "a.out");
+    REQUIRE(arguments['o'][0] == "a.out");
+    REQUIRE(arguments.get<std::string>("output") == "a.out");
+  }
+  THEN("The next parse uses the modified scheme") {
+    arguments.parse(std::vector<std::string>{"--verbose"});
+    REQUIRE(arguments["verbose"][0] == "true");
+    REQUIRE(arguments["output"].size() == 0);
+  }
+}
+
+SCENARIO("Definition parses argv that doesn't outlive the parse") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments | (named(name("jobs"), name('j')) << value(any()));
+  {
+    std::vector<std::string> storage{"prog", "--jobs", "12"};
+    std::vector<char*> argv;
+    for (auto& s : storage) argv.push_back(&s[0]);
+    arguments.parse(int(argv.size()), argv.data());
+  }
+  THEN("Typed values are read from copies") {
+    REQUIRE(arguments.get<int>("jobs") == 12);
+    REQUIRE(arguments.get_all<int>('j') == std::vector<int>{12});
+    REQUIRE(arguments("jobs") == "12");
+  }
+}
+
+SCENARIO("Expected holds a value or an error only") {
+  using namespace optspp;
+  struct no_default {
+    explicit no_default(int v) : v(v) {}
+    int v;
+  };
+  using result = expected<no_default, std::string>;
+  const result ok(no_default(1));
+  const auto failed = result::failure("bad");
+  THEN("Neither type has to be default constructible") {
+    REQUIRE(ok.has_value());
+    REQUIRE(ok->v == 1);
+    REQUIRE(!failed);
+    REQUIRE(failed.error() == "bad");
+  }
+  THEN("Value and error of the same type are told apart") {
+    const auto e = expected<std::string, std::string>::failure("bad");
+    REQUIRE(!e.has_value());
+    REQUIRE(e.error() == "bad");
+    REQUIRE(*expected<std::string, std::string>(std::string("ok")) == "ok");
+  }
+}
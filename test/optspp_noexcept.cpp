@@ -0,0 +1,29 @@
+// Built with -fno-exceptions: parsing reports errors with try_parse
+#include <catch.hpp>
+#include <optspp/optspp>
+
+SCENARIO("Parsing with exceptions disabled") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("force"),
+             name('f'),
+             implicit_values("true"))
+       << value("true", {"on", "yes"})
+       << value("false", {"off", "no"}))
+    | (positional(name("filename"), min_count(1))
+       << (value(any())));
+  auto cs = arguments.compile();
+
+  auto r = cs->try_parse(std::vector<std::string>{"-f", "file"});
+  REQUIRE(r);
+  REQUIRE((*r)["force"][0] == "true");
+
+  r = cs->try_parse(std::vector<std::string>{"-f", "on", "-f", "off", "file"});
+  REQUIRE(!r);
+  REQUIRE(r.error().code == error_code::VALUE_CONFLICT);
+
+  auto rs = cs->parse_batch({{"file"}, {"--force=maybe"}}, 2);
+  REQUIRE(rs[0]);
+  REQUIRE(rs[1].error().code == error_code::CONSUME_VALUE_FAILED);
+}
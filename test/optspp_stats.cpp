@@ -0,0 +1,36 @@
+// Built with OPTSPP_PARSE_STATS: parses collect statistics
+#include <catch.hpp>
+#include <optspp/optspp>
+
+SCENARIO("Parse statistics") {
+  using namespace optspp;
+  scheme::definition arguments;
+  arguments
+    | (named(name("output"), name('o')) << value(any()))
+    | (named(name("verbose"), name('v'), implicit_values("true")) << value("true") << value("false"))
+    | (positional(name("file"), max_count(2)) << value(any()));
+  auto cs = arguments.compile();
+  scheme::parse_context ctx;
+
+  WHEN("Parsed arguments") {
+    cs->parse(std::vector<std::string>{"-v", "--output=a.out", "main.cpp", "util.cpp"}, ctx);
+    const auto stats = ctx.stats();
+    THEN("Counters match the work counters") {
+      REQUIRE(stats.passes == ctx.counters().passes);
+      REQUIRE(stats.entities_visited == ctx.counters().nodes_visited);
+      REQUIRE(stats.tokens_examined == ctx.counters().tokens_scanned);
+      REQUIRE(stats.passes > 0);
+      REQUIRE(stats.buffer_growths > 0);
+      REQUIRE(stats.preprocess_time.count() > 0);
+      REQUIRE(stats.passes_time.count() > 0);
+      REQUIRE(stats.validate_time.count() > 0);
+    }
+    WHEN("Parsed again with the same context") {
+      cs->parse(std::vector<std::string>{"-v", "--output=a.out", "main.cpp", "util.cpp"}, ctx);
+      THEN("Statistics are of the last parse and the token and context buffers are reused") {
+        REQUIRE(ctx.stats().passes == stats.passes);
+        REQUIRE(ctx.stats().buffer_growths < stats.buffer_growths);
+      }
+    }
+  }
+}